@@ -1,1000 +1,7275 @@
-#include <stdio.h>
-#include <ctype.h>
-#include <string.h>
-#include <stdlib.h>
-
-#define MAX_RECORD_SIZE 100
-
-typedef enum {
-  EMPTY = 0,
-  PAWN,
-  ROOK,
-  KNIGHT,
-  BISHOP,
-  QUEEN,
-  KING,
-} Type;
-
-typedef enum {
-  NONE = 0,
-  WHITE,
-  BLACK,
-} Color;
-
-typedef struct {
-  Type type;
-  Color color;
-  int hasMoved;
-} Piece;
-
-typedef struct {
-    Piece board[8][8];
-    int whiteToMove;
-    int whiteKingPos[2];
-    int blackKingPos[2];
-} GameState;
-
-typedef struct {
-  int fromFile;
-  int fromRank;
-  int toFile;
-  int toRank;
-} Move;
-
-const Piece EMPTY_PIECE = {EMPTY, NONE, 0};
-
-int modify_memory(Move **moves, int gameLength, int mod) {
-  if (gameLength + mod) {
-    Move *temp;
-    temp = realloc(*moves, (gameLength + mod) * sizeof(Move));
-    if (!temp) {
-      return 0;
-    }
-    *moves = temp;
-    return 1;
-  } else {
-    free(*moves);
-    *moves = NULL;
-    return 1;
-  }
-}
-
-void free_memory(Move **moves) {
-	free(*moves);
-	*moves = NULL;
-}
-
-void initializeBoard(GameState *state) {
-  // Set all board positions to EMPTY and color to NONE
-  for (int i = 0; i < 8; i++) {
-    for (int j = 0; j < 8; j++) {
-        state->board[i][j] = EMPTY_PIECE;
-    }
-  }
-
-  // Set up the white pieces
-  state->board[0][0].type = ROOK;
-  state->board[0][1].type = KNIGHT;
-  state->board[0][2].type = BISHOP;
-  state->board[0][3].type = KING;
-  state->board[0][4].type = QUEEN;
-  state->board[0][5].type = BISHOP;
-  state->board[0][6].type = KNIGHT;
-  state->board[0][7].type = ROOK;
-  for (int i = 0; i < 8; i++) {
-    state->board[0][i].color = BLACK;
-    state->board[1][i].color = BLACK;
-    state->board[1][i].type = PAWN;
-  }
-
-  // Set up the black pieces
-  state->board[7][0].type = ROOK;
-  state->board[7][1].type = KNIGHT;
-  state->board[7][2].type = BISHOP;
-  state->board[7][3].type = KING;
-  state->board[7][4].type = QUEEN;
-  state->board[7][5].type = BISHOP;
-  state->board[7][6].type = KNIGHT;
-  state->board[7][7].type = ROOK;
-  for (int i = 0; i < 8; i++) {
-    state->board[6][i].color = WHITE;
-    state->board[7][i].color = WHITE;
-    state->board[6][i].type = PAWN;
-  }
-
-  // Set other state information
-  state->whiteToMove = 1;
-  state->whiteKingPos[0] = 7;
-  state->whiteKingPos[1] = 3;
-  state->blackKingPos[0] = 0;
-  state->blackKingPos[1] = 3;
-}
-
-void initializeTestBoard(GameState *state) {
-  for (int i = 0; i < 8; i++) {
-    for (int j = 0; j < 8; j++) {
-      state->board[i][j] = EMPTY_PIECE;
-    }
-  }
-
-  state->board[7][3].type = KING;
-  state->board[7][3].color = WHITE;
-  state->board[0][3].type = KING;
-  state->board[0][3].color = BLACK;
-
-  state->board[0][0].type = ROOK;
-  state->board[0][0].color = BLACK;
-
-  state->board[0][1].type = BISHOP;
-  state->board[0][1].color = BLACK;
-
-  state->board[0][2].type = KNIGHT;
-  state->board[0][2].color = BLACK;
-
-  state->whiteToMove = 1;
-  state->whiteKingPos[0] = 7;
-  state->whiteKingPos[1] = 3;
-  state->blackKingPos[0] = 0;
-  state->blackKingPos[1] = 3;
-}
-
-int parseMove(char *move) {
-  if (!(tolower(move[0]) >= 'a' && tolower(move[0]) <= 'h' &&
-      tolower(move[2]) >= 'a' && tolower(move[2]) <= 'h' &&
-      move[1] >= '1' && move[1] <= '8' &&
-      move[3] >= '1' && move[3] <= '8') ||
-      !move || !(move + 1) || !(move + 2) || !(move + 3)) {
-        return 0;
-  }
-  
-  move[0] = tolower(move[0]) - 'a';
-  move[1] = 8 - (move[1] - '0');
-  move[2] = tolower(move[2]) - 'a';
-  move[3] = 8 - (move[3] - '0');
-
-  return 1;
-}
-
-void load_move(char *move, Move *moves) {
-	moves->fromFile = move[0];
-	moves->fromRank = move[1];
-	moves->toFile = move[2];
-	moves->toRank = move[3];
-}
-
-Piece checkTileForPiece(GameState *state, int fromRank, int fromFile, int verOffset, int horOffset, int verLim, int horLim) {
-  if (fromRank + verOffset >= 8 || fromRank + verOffset < 0 ||
-      fromFile + horOffset >= 8 || fromFile + horOffset < 0 ||
-      fromRank + verOffset == verLim || fromFile + horOffset == horLim) {
-    return EMPTY_PIECE;
-  } else if (state->board[fromRank + verOffset][fromFile + horOffset].type != EMPTY) {
-    return state->board[fromRank + verOffset][fromFile + horOffset];
-  } else {
-    return checkTileForPiece(state, fromRank + verOffset, fromFile + horOffset, verOffset, horOffset, verLim, horLim);
-  }
-}
-
-void moveInBoard(GameState *state, Move *move, Piece *piece) {
-  int fromFile = move->fromFile, fromRank = move->fromRank, toFile = move->toFile, toRank = move->toRank;
-  char prom;
-  int breakFlag = 0;
-
-  piece->hasMoved = 1;
-
-  if (piece->type == PAWN && (toRank == 0 || toRank == 7)) {
-    printf("A pawn is promoted, enter its type: q (queen), b (bishop), n (knight), r (rook)\n> ");
-    while (scanf(" %c", &prom) == 1) {
-      switch (prom) {
-        case 'q':
-          piece->type = QUEEN;
-          breakFlag = 1;
-          break;
-        case 'b':
-          piece->type = BISHOP;
-          breakFlag = 1;
-          break;
-        case 'n':
-          piece->type = KNIGHT;
-          breakFlag = 1;
-          break;
-        case 'r':
-          piece->type = ROOK;
-          breakFlag = 1;
-          break;
-        default:
-          printf("Wrong input. Try again...\n> ");
-          break;
-      }
-      if (breakFlag) break;
-      fflush(stdin);
-    }
-  }
-
-  if (piece->type == KING && state->whiteToMove) {
-    state->whiteKingPos[0] = toRank;
-    state->whiteKingPos[1] = toFile;
-  } else if (piece->type == KING && !state->whiteToMove) {
-    state->blackKingPos[0] = toRank;
-    state->blackKingPos[1] = toFile;
-  }
-
-  state->board[toRank][toFile] = *piece;
-  state->board[fromRank][fromFile] = EMPTY_PIECE;
-
-  state->whiteToMove = !state->whiteToMove;
-}
-
-int isCheck(GameState *oldState, Move *move, Piece *oldPiece) {
-  int fromFile = move->fromFile, fromRank = move->fromRank, toFile = move->toFile, toRank = move->toRank;
-  int checkRank, checkFile, white, oppositeColor;
-
-  GameState state = *oldState;
-  Piece piece = *oldPiece;
-
-  // make hypothetical move in temporary board with temporary piece
-  moveInBoard(&state, move, &piece);
-
-  // Pawn check can only be in one direction so it has
-  // to be checked by different offsets for each side
-
-  white = oldState->whiteToMove ? 1 : 0;
-  if (white) {
-    checkRank = state.whiteKingPos[0];
-    checkFile = state.whiteKingPos[1];
-    oppositeColor = BLACK;
-
-    // pawn check for white
-    if (state.board[checkRank - 1][checkFile + 1].type == PAWN &&
-        state.board[checkRank - 1][checkFile + 1].color == oppositeColor ||
-        state.board[checkRank - 1][checkFile - 1].type == PAWN &&
-        state.board[checkRank - 1][checkFile - 1].color == oppositeColor) {
-      return 1;
-    }
-
-  } else {
-    checkRank = state.blackKingPos[0];
-    checkFile = state.blackKingPos[1];
-    oppositeColor = WHITE;
-
-    // pawn check for black
-    if (state.board[checkRank + 1][checkFile + 1].type == PAWN &&
-        state.board[checkRank + 1][checkFile + 1].color == oppositeColor ||
-        state.board[checkRank + 1][checkFile - 1].type == PAWN &&
-        state.board[checkRank + 1][checkFile - 1].color == oppositeColor) {
-      return 1;
-    }
-  }
-
-  Piece vPosRook = checkTileForPiece(&state, checkRank, checkFile, 1, 0, 0, 0);
-  if ((vPosRook.type == ROOK || vPosRook.type == QUEEN) && vPosRook.color == oppositeColor) {
-    return 1;
-  }
-
-  Piece vNegRook = checkTileForPiece(&state, checkRank, checkFile, -1, 0 , 0, 0);
-  if ((vNegRook.type == ROOK || vNegRook.type == QUEEN) && vNegRook.color == oppositeColor) {
-    return 1;
-  }
-
-  Piece hPosRook = checkTileForPiece(&state, checkRank, checkFile, 0, 1, 0, 0);
-  if ((hPosRook.type == ROOK || hPosRook.type == QUEEN) && hPosRook.color == oppositeColor) {
-    return 1;
-  }
-
-  Piece hNegRook = checkTileForPiece(&state, checkRank, checkFile, 0, -1, 0, 0);
-  if ((hNegRook.type == ROOK || hNegRook.type == QUEEN) && hNegRook.color == oppositeColor) {
-    return 1;
-  }
-
-  Piece vPosBishop = checkTileForPiece(&state, checkRank, checkFile, 1, 1, 0, 0);
-  if ((vPosBishop.type == BISHOP || vPosBishop.type == QUEEN) && vPosBishop.color == oppositeColor) {
-    return 1;
-  }
-
-  Piece vNegBishop = checkTileForPiece(&state, checkRank, checkFile, -1, -1, 0, 0);
-  if ((vNegBishop.type == BISHOP || vNegBishop.type == QUEEN) && vNegBishop.color == oppositeColor) {
-    return 1;
-  }
-
-  Piece hPosBishop = checkTileForPiece(&state, checkRank, checkFile, -1, 1, 0, 0);
-  if ((hPosBishop.type == BISHOP || hPosBishop.type == QUEEN) && hPosBishop.color == oppositeColor) {
-    return 1;
-  }
-
-  Piece hNegBishop = checkTileForPiece(&state, checkRank, checkFile, 1, -1, 0, 0);
-  if ((hNegBishop.type == BISHOP || hNegBishop.type == QUEEN) && hNegBishop.color == oppositeColor) {
-    return 1;
-  }
-
-  int knightOffsets[8][2] = {
-    {-2, 1}, {-1, 2}, {1, 2}, {2, 1},
-    {2, -1}, {1, -2}, {-1, -2}, {-2, -1},
-  };
-
-  for (int i = 0; i < 8; i++) {
-    Piece knight = state.board[checkRank + knightOffsets[i][0]][checkFile  + knightOffsets[i][1]];
-    if (knight.type == KNIGHT && knight.color == oppositeColor) {
-      return 1;
-    }
-  }
-
-	return 0;
-}
-
-int isLegalRookMove(GameState *state, Move *move) {
-  int fromFile = move->fromFile, fromRank = move->fromRank, toFile = move->toFile, toRank = move->toRank;
-  if (fromFile != toFile &&  fromRank != toRank) {
-    return 0;
-  }
-
-  int vertical = fromFile - toFile == 0 ? 1 : 0;
-
-  int verOffset = 0, horOffset = 0;
-
-  if (vertical) {
-    verOffset = 1;
-    if (fromRank - toRank > 0) {
-      verOffset = -1;
-    }
-
-    Piece moveSquare = checkTileForPiece(state, fromRank, fromFile, verOffset, horOffset, toRank + verOffset, -1);
-    if (moveSquare.type != EMPTY) {
-      return 0;
-    }
-  } else {
-    horOffset = 1;
-    if (fromFile - toFile > 0) {
-      horOffset = -1;
-    }
-
-    Piece moveSquare = checkTileForPiece(state, fromRank, fromFile, verOffset, horOffset, -1, toFile + horOffset);
-    if (moveSquare.type != EMPTY) {
-      return 0;
-    }
-  }
-  
-  return 1;
-}
-
-int isLegalBishopMove(GameState *state, Move *move) {
-  int fromFile = move->fromFile, fromRank = move->fromRank, toFile = move->toFile, toRank = move->toRank;
-  if (abs(fromFile - toFile) != abs(fromRank - toRank)) {
-    return 0;
-  }
-
-  // vertical if a8 h1 diagonal; horizontal is a1 h8 diagonal
-  int rankOffset = 1, fileOffset = 1, vertical = (fromRank - toRank ^ fromFile - toFile) >= 0 ? 1 : 0;
-
-  if (vertical) {
-    if (fromRank - toRank > 0) {
-      rankOffset = -1;
-      fileOffset = -1;
-    }
-  } else {
-    if (fromRank - toRank > 0) {
-      rankOffset = -1;
-    } else {
-      fileOffset = -1;
-    }
-  }
-
-  Piece moveSquare = checkTileForPiece(state, fromRank, fromFile, rankOffset, fileOffset, toRank + rankOffset, toFile + fileOffset);
-  if (moveSquare.type != EMPTY) {
-    return 0;
-  }
-
-  return 1;
-}
-
-int isLegalKnightMove(GameState *state, Move *move) {
-  int fromFile = move->fromFile, fromRank = move->fromRank, toFile = move->toFile, toRank = move->toRank;
-
-  if (abs(fromFile - toFile) == 2 && abs(fromRank - toRank) == 1 ||
-      abs(fromFile - toFile) == 1 && abs(fromRank - toRank) == 2) {
-    return 1;
-  }
-
-  return 0;
-}
-
-int isLegalPawnMove(GameState *state, Move *move) {
-  int fromFile = move->fromFile, fromRank = move->fromRank, toFile = move->toFile, toRank = move->toRank;
-  int rankDiff = fromRank - toRank, fileDiff = fromFile - toFile;
-  int whiteToMove = state->whiteToMove;
-
-  if ((whiteToMove && rankDiff < 0 || !whiteToMove && rankDiff > 0) ||
-      (fileDiff == 0 && state->board[toRank][toFile].type != EMPTY) || // cant take not diagonally
-      (abs(fileDiff) == 1 && abs(rankDiff) == 2) || // cant take skipping a square of the first move
-      (abs(fileDiff) == 1 && rankDiff == 0) ||
-      (abs(fileDiff) == 1 && state->board[toRank][toFile].type == EMPTY) || // can move diagonally only if can take
-      abs(fileDiff) > 1 || abs(rankDiff) > 2 || // max move range 
-      (abs(rankDiff) == 2 && state->board[fromRank][fromFile].hasMoved)) { // two squares step
-    return 0;
-  }
-
-	return 1;
-}
-
-int isLegalKingMove(GameState *state, Move *move) {
-  int fromFile = move->fromFile, fromRank = move->fromRank, toFile = move->toFile, toRank = move->toRank;
-
-  if (abs(fromFile - toFile) > 1 || abs(fromRank - toRank) > 1 ||
-      (abs(fromRank - toFile) == 0 && abs(fromRank - toRank) == 0)) {
-    return 0;
-  }
-
-	return 1;
-}
-
-int isLegalMove(GameState *state, Move *move) {
-  int legal;
-  int fromFile = move->fromFile, fromRank = move->fromRank, toFile = move->toFile, toRank = move->toRank;
-
-  switch (state->board[fromRank][fromFile].type) {
-    case ROOK:
-      legal = isLegalRookMove(state, move);
-      break;
-    case BISHOP:
-      legal = isLegalBishopMove(state, move);
-      break;
-    case QUEEN:
-      legal = isLegalRookMove(state, move) || isLegalBishopMove(state, move);
-      break;
-    case KNIGHT:
-      legal = isLegalKnightMove(state, move);
-      break;
-    case PAWN:
-      legal = isLegalPawnMove(state, move);
-      break;
-    case KING:
-      legal = isLegalKingMove(state, move);
-      break;
-  }
-
-  return legal;
-}
-
-int makeMove(GameState *state, Move *move) {
-  int fromFile = move->fromFile, fromRank = move->fromRank, toFile = move->toFile, toRank = move->toRank;
-
-  if (fromFile == toFile && fromRank == toRank) {
-    printf("Invalid move (piece didn't move)\n> ");
-    return 0;
-  }
-
-  Piece piece = state->board[fromRank][fromFile];
-
-  // Check for empty square
-  if (piece.color == NONE || piece.type == EMPTY) {
-    printf("Invalid move (no piece at %c%d)\n> ", 'a' + fromFile, 8 - fromRank);
-    return 0;
-  }
-
-  // Check for the right color move
-  if ((piece.color == WHITE && !state->whiteToMove) ||
-      (piece.color == BLACK && state->whiteToMove)) {
-    printf("Invalid move (wrong color to move)\n> ");
-    return 0;
-  }
-
-  if (!isLegalMove(state, move)) {
-    printf("Invalid move (illegal move)\n> ");
-    return 0;
-  }
-
-  if (state->board[fromRank][fromFile].color == state->board[toRank][toFile].color) {
-    printf("Invalid move (illegal move)\n> ");
-    return 0;
-  }
-
-  if (isCheck(state, move, &piece)) {
-    printf("Invalid move (check after move)\n> ");
-    return 0;
-  }
-
-  moveInBoard(state, move, &piece);
-
-  return 1;
-}
-
-void displayBoard(GameState *state) {
- printf("\e[1;1H\e[2J");
-  // system("cls");
-  for (int i = 0; i < 8; i++) {
-    for (int j = 0; j < 8; j++) {
-      char charToPrint;
-
-      switch (state->board[i][j].type) {
-        case PAWN:
-          charToPrint = 'P';
-          break;
-        case ROOK:
-          charToPrint = 'R';
-          break;
-        case KNIGHT:
-          charToPrint = 'N';
-          break;
-        case BISHOP:
-          charToPrint = 'B';
-          break;
-        case KING:
-          charToPrint = 'K';
-          break;
-        case QUEEN:
-          charToPrint = 'Q';
-          break;
-        case EMPTY:
-          charToPrint = '.';
-          break;
-      }
-
-      if (state->board[i][j].color == BLACK) {
-        charToPrint = tolower(charToPrint);
-      }
-
-      printf("%-2c", charToPrint);
-    }
-    printf("\n");
-  }
-  printf("\n");
-}
-
-void replayGame(Move *moves, int gameLength) {
-  GameState state;
-  initializeBoard(&state);
-
-  for (int i = 0; i < gameLength; i++) {
-    makeMove(&state, &moves[i]);
-  }
-
-  displayBoard(&state);
-}
-
-void insert_moves(GameState *state, Move **moves, int *gameLength) {
-  char move[5], input_buffer[20];
-  printf("\nEnter move:\n> ");
-  while (scanf("%s", input_buffer) == 1) {
-    if (strcmp(input_buffer, "x") == 0) {
-      break;
-    }
-
-    for (int i = 0; i < 4; i++) {
-      move[i] = input_buffer[i];
-    }
-    move[4] = '\0';
-	
-    if (parseMove(move)) {
-      if (!modify_memory(moves, *gameLength, 1))
-        return;
-      load_move(move, &(*moves)[*gameLength]);
-      if (makeMove(state, &(*moves)[*gameLength])) {
-        *gameLength += 1;
-        displayBoard(state);
-        printf("\nEnter move:\n> ");
-      }
-    } else {
-      printf("Invalid move: %s (wrong input)\n> ", move);
-    }
-    fflush(stdin);
-  }
-}
-
-void insertGame(Move **moves, int *gameLength) {
-  GameState state;
-  initializeBoard(&state);
-  displayBoard(&state);
-  *gameLength = 0;
-
-  insert_moves(&state, moves, gameLength);
-}
-
-void continue_editing(Move **moves, int *gameLength) {
-  GameState state;
-  initializeBoard(&state);
-
-  for (int i = 0; i < *gameLength; i++) {
-    makeMove(&state, &(*moves)[i]);
-  }
-
-  displayBoard(&state);
-
-  insert_moves(&state, moves, gameLength);
-}
-
-void unparse_move(Move *move, char *moveStr) {
-  moveStr[0] = move->fromFile + 'a';
-  moveStr[1] = 8 + ('0' - move->fromRank);
-  moveStr[2] = move->toFile + 'a';
-  moveStr[3] = 8 + ('0' - move->toRank);
-}
-
-void view_record(Move *moves, int *gameLength) {
-  char moveStr[5];
-
-  printf("\n");
-  for (int i = 0; i < *gameLength; i++) {
-    unparse_move(&moves[i], moveStr);
-    printf(" %d. %s\n", i + 1, moveStr);
-  }
-  printf("\n");
-}
-
-void insert_in_record(Move **origMoves, int *gameLength) {
-  int num_buf, exit_flag = 0;
-  char move_str[5], move_buf[20];
-
-  Move *moves = NULL;
-  int oldGamelength = *gameLength;
-
-  if(!modify_memory(&moves, oldGamelength, 0))
-    return;
-
-  for (int i = 0; i < *gameLength; i++) {
-    // printf("%d", moves[i].fromRank);
-    // printf("%d", (*origMoves)[i].fromRank);
-    moves[i] = (*origMoves)[i];
-  }
-
-  while (!exit_flag) {
-    printf("\nEnter the move you want to insert after:\n> ");
-
-    while (scanf("%i", &num_buf) != 1) {
-      printf("Wrong input! Try again...\n> ");
-      fflush(stdin);
-    }
-
-    if (num_buf > *gameLength || num_buf < 0) {
-      printf("Wrong input! Try again...\n");
-      continue; 
-    }
-
-    while (1) {
-      printf("Enter a move you want to add, x when finished or z to discard changes:\n> ");
-
-      while (scanf("%s", move_buf) != 1) {
-        printf("Wrong input! Try again...\n> ");
-        fflush(stdin);
-      }
-
-      if (move_buf[0] == 'x') {
-        GameState state;
-        initializeBoard(&state);
-        for (int i = 0; i < *gameLength; i++) {
-          if (!makeMove(&state, &moves[i])) {
-            printf("Unable to save changes since the record has mistakes!\n");
-            continue;
-          }
-        }
-
-		    free_memory(origMoves);
-		    *origMoves = moves;
-				
-        printf("Game was saved successfully!\n");
-
-        exit_flag = 1;
-        break;
-      }
-
-      if (move_buf[0] == 'z') {
-        printf("Discarding changes!\n");
-        *gameLength = oldGamelength;
-		
-		    free_memory(&moves);
-        exit_flag = 1;
-        break;
-      }
-
-      for (int i = 0; i < 4; i++) {
-        move_str[i] = move_buf[i];
-      }
-      move_str[4] = '\0';
-
-      Move move;
-      if (parseMove(move_str)) {
-      	load_move(move_str, &move);
-      	
-      	*gameLength += 1;
-      	if(!modify_memory(&moves, *gameLength, 1))
-          return;
-
-        for (int i = *gameLength - 1; i >= num_buf; i--) {
-          moves[i + 1] = moves[i];
-        }
-
-        moves[num_buf] = move;
-
-        num_buf++;
-      } else {
-        printf("Wrong input! Try again...\n");
-        fflush(stdin);
-      }
-    }
-  }
-}
-
-void remove_from_record(Move **origMoves, int *gameLength) {
-  int num_buf, exit_flag = 0;
-  char option_buf[20];
-
-  Move *moves = NULL;
-  int oldGamelength = *gameLength;
-
-  if (!modify_memory(&moves, oldGamelength, 0))
-    return;
-
-  for (int i = 0; i < *gameLength; i++) {
-    moves[i] = (*origMoves)[i];
-  }
-  
-  while (!exit_flag) {
-    printf("\nEnter the move you want to remove or 0 to finish:\n> ");
-
-    while (scanf("%i", &num_buf) != 1) {
-      printf("Wrong input! Try again...\n> ");
-      fflush(stdin);
-    }
-
-    if (num_buf == 0) {
-      free_memory(origMoves);
-      *origMoves = moves;
-	  
-      return;
-    }
-
-    if (num_buf > *gameLength || num_buf <= 0) {
-      printf("Wrong input! Try again...\n");
-      continue; 
-    }
-	
-    for (int i = num_buf - 1; i < *gameLength - 1; i++) {
-      moves[i] = moves[i + 1];
-    }
-    
-    if (!modify_memory(&moves, *gameLength, -1))
-      return;
-
-    *gameLength -= 1;
-
-    while (1) {
-      view_record(moves, gameLength);
-      printf("\nEnter c to continue removing, x to finish removing, v to insert new moves or z to discard changes:\n> ");
-
-      while (scanf("%s", option_buf) != 1) {
-        printf("Wrong input! Try again...\n> ");
-        fflush(stdin);
-      }
-
-      if (option_buf[0] == 'c') {
-        break;
-      }
-
-      if (option_buf[0] == 'x') {
-        GameState state;
-        initializeBoard(&state);
-        for (int i = 0; i < *gameLength; i++) {
-          if (!makeMove(&state, &moves[i])) {
-            printf("Unable to save changes since the record has illegal moves!\n");
-            *gameLength = oldGamelength;
-            free_memory(&moves);
-            return;
-          }
-        }
-
-        free_memory(origMoves);
-      	*origMoves = moves;
-
-        printf("Game was saved successfully!\n");
-
-        exit_flag = 1;
-        break;
-      }
-
-      if (option_buf[0] == 'z') {
-        printf("Discarding changes\n");
-        *gameLength = oldGamelength;
-
-        free_memory(&moves);
-        exit_flag = 1;
-        return;
-      }
-
-      if (option_buf[0] == 'v') {
-        insert_in_record(&moves, gameLength);
-        break;
-      }
-    }
-  }
-}
-
-void save_data(Move *moves, int *gameLength) {
-  char filename[50], move[5];;
-
-  while (1) {
-    printf("Enter filename of the file with game:\n> ");
-    if (scanf("%s", filename) != 1) {
-      printf("Wrong input! Try again\n> ");
-      continue;
-    }
-    break;
-  }
-
-  FILE *fp;
-  fp = fopen(filename, "wb");
-
-  if (!fp) {
-    printf("\nThere's no such file!\n\n");
-    return;
-  }
-
-  for (int i = 0; i < *gameLength; i++) {
-    unparse_move(&moves[i], move);
-    fprintf(fp, "%s\n", move);
-  }
-
-  printf("\nThe game was saved succesfully!\n\n");
-
-  fclose(fp);
-}
-
-void load_data(Move **moves, int *gameLength) {
-  int game_length = 0;
-  char filename[50];
-  char move_buffer[20], move[5];
-
-  while (1) {
-    printf("Enter filename of the file with game:\n> ");
-    if (scanf("%s", filename) != 1) {
-      printf("Wrong input! Try again\n> ");
-      continue;
-    }
-    break;
-  }
-
-  FILE *fp;
-  fp = fopen(filename, "r");
-
-  if (!fp) {
-    printf("\nThere's no such file!\n\n");
-    return;
-  }
-
-  while (!feof(fp)) {
-    if (fscanf(fp, "%s", move_buffer) == 1) {
-      for (int i = 0; i < 4; i++) {
-        move[i] = move_buffer[i];
-      }
-      move[4] = '\0';
-
-      if (!parseMove(move)) {
-        free_memory(moves);
-        return;
-  	}
-	  
-	  modify_memory(moves, game_length, 1);
-	  load_move(move, &(*moves)[game_length]);
-	  
-	  game_length++;
-	  
-    } else {
-      break;
-    }
-  }
-
-  GameState state;
-  initializeBoard(&state);
-  for (int i = 0; i < game_length; i++) {
-    if (!makeMove(&state, &(*moves)[i])) {
-      printf("\nUnable to load game since it has illegal moves\n\n");
-      free_memory(moves);
-    }
-  }
-
-  printf("\nGame was loaded succesfully!\n\n");
-
-  fclose(fp);
-  
-  *gameLength = game_length;
-}
-
-void edit_prompt(Move **moves, int *gameLength) {
-  int option;
-
-  while (1) {
-    printf("Select an option:\n");
-    printf("  1. View the record\n");
-    printf("  2. Continue editing the record\n");
-    printf("  3. Insert moves to the record\n");
-    printf("  4. Remove moves from the record\n");
-    printf("  5. Return to menu\n\n> ");
-
-    while (scanf("%d", &option) != 1) {
-      printf("Wrong input! Try again...\n> ");
-      fflush(stdin);
-    }
-
-    switch (option) {
-      case 1:
-        view_record(*moves, gameLength);
-        break;
-      case 2:
-        continue_editing(moves, gameLength);
-        break;
-      case 3:
-        insert_in_record(moves, gameLength);
-        break;
-      case 4:
-        remove_from_record(moves, gameLength);
-        break;
-      case 5:
-        return;
-        break;
-      default:
-        printf("There's no such option. Try again...\n> ");
-        break;
-    }
-    fflush(stdin);
-  }
-}
-
-int main(void) {
-  Move *moves = NULL;
-  int option = 0, replaySize = 0;
-  int *gameLength = malloc(sizeof(int));
-  *gameLength = 0;
-
-  // no en passant, no castling, format is: e2e4 (square from, square to)
-  while (1) {
-    printf("Select an option:\n");
-    printf("  1. Insert a game\n");
-    printf("  2. Replay a game\n");
-    printf("  3. Edit the record\n");
-    printf("  4. Load game from a file\n");
-    printf("  5. Save game to a file\n");
-    printf("  6. Clear game record\n");
-    printf("  7. Exit\n\n> ");
-
-    while (scanf("%d", &option) != 1) {
-      printf("Wrong input! Try again...\n> ");
-      fflush(stdin);
-    }
-
-    switch (option) {
-      case 1:
-        insertGame(&moves, gameLength);
-        break;
-      case 2:
-        printf("Enter the number of move you want to see:\n\n> ");
-        while (scanf("%d", &replaySize) != 1) {
-          printf("Wrong input! Try again...\n> ");
-        }
-        if (replaySize <= 0 || replaySize > *gameLength) {
-          printf("The move number is out of range!\n");
-          break;
-        }
-        replayGame(moves, replaySize);
-        break;
-      case 3:
-        edit_prompt(&moves, gameLength);
-        break;
-      case 4:
-        load_data(&moves, gameLength);
-        break;
-      case 5:
-        save_data(moves, gameLength);
-        break;
-      case 6:
-        *gameLength = 0;
-        free_memory(&moves);
-        break;
-      case 7:
-        printf("\nSee you next time\n\n");
-        return 0;
-        break;
-      default:
-        printf("There's no such option. Try again...\n> ");
-        break;
-    }
-    fflush(stdin);
-  }
-  
-  return 0;
+#include <stdio.h>
+#include <ctype.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#ifdef __linux__
+#include <linux/io_uring.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define MAX_RECORD_SIZE 100
+
+typedef enum {
+  EMPTY = 0,
+  PAWN,
+  ROOK,
+  KNIGHT,
+  BISHOP,
+  QUEEN,
+  KING,
+} Type;
+
+typedef enum {
+  NONE = 0,
+  WHITE,
+  BLACK,
+} Color;
+
+typedef struct {
+  Type type;
+  Color color;
+  int hasMoved;
+} Piece;
+
+typedef struct {
+    Piece board[8][8];
+    int whiteToMove;
+    int whiteKingPos[2];
+    int blackKingPos[2];
+    uint64_t key; // Zobrist hash of the position, kept up to date by moveInBoard
+    // kept for FEN only, the rules implemented here have no castling or en passant
+    int castling; // CASTLE_* bits
+    int enPassant; // square (rank * 8 + file) a pawn skipped on the last move, -1 if none
+    int halfmoveClock;
+    int fullmoveNumber;
+} GameState;
+
+#define CASTLE_WHITE_KING 1
+#define CASTLE_WHITE_QUEEN 2
+#define CASTLE_BLACK_KING 4
+#define CASTLE_BLACK_QUEEN 8
+
+typedef struct {
+  int fromFile;
+  int fromRank;
+  int toFile;
+  int toRank;
+  int promotion; // piece type a pawn promotes to, EMPTY if not chosen yet
+} Move;
+
+typedef enum {
+  MOVE_OK = 0,
+  MOVE_NOT_MOVED,
+  MOVE_NO_PIECE,
+  MOVE_WRONG_COLOR,
+  MOVE_ILLEGAL,
+  MOVE_CHECK,
+} MoveStatus;
+
+const char *MOVE_STATUS_TEXT[] = {
+  "legal",
+  "piece didn't move",
+  "no piece",
+  "wrong color to move",
+  "illegal move",
+  "check after move",
+};
+#define MOVE_STATUS_COUNT (sizeof(MOVE_STATUS_TEXT) / sizeof(MOVE_STATUS_TEXT[0]))
+
+// Binary game file: header followed by plyCount packed moves.
+// Fields are stored in host byte order (little-endian on every target we build for).
+// Version 2 came with rule fixes (king on the e-file, sliders capture, pawns don't jump,
+// kings keep apart). Version 1 files still load, but their validated flag was set under
+// the old rules and is ignored.
+#define GAME_FILE_MAGIC 0x4d47574c // "LWGM"
+#define GAME_FILE_VERSION 2
+#define GAME_FILE_OLDEST_VERSION 1
+#define GAME_FLAG_VALIDATED 0x0001
+#define GAME_FILE_EXT ".lwg"
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t flags;
+  uint32_t plyCount;
+  uint32_t crc; // CRC-32 of the packed moves
+} GameFileHeader;
+
+// Game archive: header, games stored back to back as packed moves, then an index
+// of ArchiveEntry records and a footer pointing at it. Appending writes new games
+// over the old index and puts the grown index after them. That isn't crash-safe: from
+// the first append until the archive is closed the file has no valid footer, so a
+// crash in between loses the whole archive. Copy it first if it matters.
+// Versions follow the game file: a version 1 archive is read with its validated flags
+// ignored, and appending to one clears them and upgrades it to the current version.
+#define ARCHIVE_MAGIC 0x5241574c // "LWAR"
+#define ARCHIVE_VERSION 2
+#define ARCHIVE_OLDEST_VERSION 1
+#define ARCHIVE_EXT ".lwa"
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;
+} ArchiveHeader;
+
+typedef struct {
+  uint64_t gameId;
+  uint64_t offset;
+  uint32_t plyCount;
+  uint32_t crc; // CRC-32 of the packed moves
+  uint16_t flags;
+  uint16_t reserved[3];
+} ArchiveEntry;
+
+typedef struct {
+  uint64_t indexOffset;
+  uint64_t gameCount;
+  uint32_t crc; // CRC-32 of the index
+  uint32_t magic;
+} ArchiveFooter;
+
+typedef struct {
+  FILE *fp;
+  ArchiveEntry *index; // loaded only when the archive is opened for appending
+  uint64_t gameCount;
+  uint64_t indexCapacity;
+  uint64_t indexOffset; // also the end of the game data
+  int writable;
+  int dirty;
+  int atEnd; // the file position is where the next game goes, only right after an append
+  int version; // of the file, raised to ARCHIVE_VERSION when the tail is written
+} Archive;
+
+// from square (6 bits) | to square (6 bits) | promotion type (3 bits), square = rank * 8 + file
+typedef uint16_t PackedMove;
+
+const Piece EMPTY_PIECE = {EMPTY, NONE, 0};
+
+// cleared by the command line tools: promotions without a recorded piece become queens
+int interactive = 1;
+
+// Hot path counters, compiled in with -DLW_PROFILE (make profile). Every thread counts
+// calls and cycles into its own block; the blocks are merged into a table at exit.
+// Recursive calls are counted, but only the outermost one is timed.
+#ifdef LW_PROFILE
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define profile_clock() __rdtsc()
+#define PROFILE_UNIT "cycles"
+#else
+#define profile_clock() ((uint64_t) (now_seconds() * 1e9))
+#define PROFILE_UNIT "ns"
+#endif
+
+typedef enum {
+  PROF_CHECK_TILE,
+  PROF_IS_CHECK,
+  PROF_IS_LEGAL_MOVE,
+  PROF_MAKE_MOVE,
+  PROF_MOVE_IN_BOARD,
+  PROF_LOAD,
+  PROF_POINTS,
+} ProfilePoint;
+
+const char *PROFILE_NAMES[PROF_POINTS] = {
+  "checkTileForPiece", "isCheck", "isLegalMove", "makeMove", "moveInBoard", "loader",
+};
+
+typedef struct ProfileCounters {
+  uint64_t calls[PROF_POINTS];
+  uint64_t cycles[PROF_POINTS];
+  uint64_t plies; // moves applied by makeMove and playMove
+  int depth[PROF_POINTS];
+  struct ProfileCounters *next;
+} ProfileCounters;
+
+typedef struct {
+  ProfilePoint point;
+  uint64_t start;
+} ProfileScope;
+
+// blocks are never freed, so the counts of finished threads are still there at exit
+ProfileCounters *profileThreads;
+pthread_mutex_t profileLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_once_t profileOnce = PTHREAD_ONCE_INIT;
+_Thread_local ProfileCounters *profileLocal;
+
+double now_seconds(void);
+
+void profile_report(void) {
+  ProfileCounters total;
+
+  memset(&total, 0, sizeof(total));
+  pthread_mutex_lock(&profileLock);
+  for (ProfileCounters *counters = profileThreads; counters; counters = counters->next) {
+    for (int i = 0; i < PROF_POINTS; i++) {
+      total.calls[i] += counters->calls[i];
+      total.cycles[i] += counters->cycles[i];
+    }
+    total.plies += counters->plies;
+  }
+  pthread_mutex_unlock(&profileLock);
+
+  fprintf(stderr, "\n%-18s %14s %18s %12s\n", "function", "calls", PROFILE_UNIT, PROFILE_UNIT "/call");
+  for (int i = 0; i < PROF_POINTS; i++) {
+    fprintf(stderr, "%-18s %14llu %18llu %12.1f\n", PROFILE_NAMES[i], (unsigned long long) total.calls[i],
+            (unsigned long long) total.cycles[i], total.calls[i] ? (double) total.cycles[i] / total.calls[i] : 0);
+  }
+  if (total.plies) {
+    fprintf(stderr, "%llu plies: %.1f checkTileForPiece and %.1f isCheck calls per ply\n",
+            (unsigned long long) total.plies, (double) total.calls[PROF_CHECK_TILE] / total.plies,
+            (double) total.calls[PROF_IS_CHECK] / total.plies);
+  }
+}
+
+void profile_init(void) {
+  atexit(profile_report);
+}
+
+ProfileCounters *profile_counters(void) {
+  if (!profileLocal) {
+    pthread_once(&profileOnce, profile_init);
+    profileLocal = calloc(1, sizeof(ProfileCounters));
+    if (!profileLocal) {
+      abort();
+    }
+    pthread_mutex_lock(&profileLock);
+    profileLocal->next = profileThreads;
+    profileThreads = profileLocal;
+    pthread_mutex_unlock(&profileLock);
+  }
+
+  return profileLocal;
+}
+
+ProfileScope profile_enter(ProfilePoint point) {
+  ProfileCounters *counters = profile_counters();
+  ProfileScope scope = {point, 0};
+
+  counters->calls[point]++;
+  if (counters->depth[point]++ == 0) {
+    scope.start = profile_clock();
+  }
+
+  return scope;
+}
+
+void profile_leave(ProfileScope *scope) {
+  ProfileCounters *counters = profileLocal;
+
+  if (--counters->depth[scope->point] == 0) {
+    counters->cycles[scope->point] += profile_clock() - scope->start;
+  }
+}
+
+// Times the rest of the enclosing function, whichever return it leaves by
+#define PROFILE_SCOPE(point) \
+  ProfileScope profileScope __attribute__((cleanup(profile_leave))) = profile_enter(point)
+#define PROFILE_PLY() (profile_counters()->plies++)
+#else
+#define PROFILE_SCOPE(point)
+#define PROFILE_PLY()
+#endif
+
+// Per ply trace, on when LW10_TRACE names the output file: parse, legality, check and
+// state update spans go into a ring allocated up front (the oldest are overwritten)
+// and are written as Chrome trace event JSON at exit
+#define TRACE_EVENTS (1 << 20)
+
+typedef struct {
+  const char *name;
+  uint64_t start; // ns
+  uint64_t end;
+  int ply; // 0 when the span isn't tied to a position
+  int tid;
+} TraceEvent;
+
+typedef struct {
+  TraceEvent *events;
+  size_t capacity;
+  atomic_size_t next;
+  const char *filename;
+} TraceRing;
+
+TraceRing *trace;
+_Thread_local int traceTid;
+
+uint64_t trace_clock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Start of a span, 0 when tracing is off
+uint64_t trace_begin(void) {
+  return trace ? trace_clock() : 0;
+}
+
+// Ply about to be played in the position, from the move counters kept for FEN
+int trace_ply(GameState *state) {
+  return (state->fullmoveNumber - 1) * 2 + !state->whiteToMove + 1;
+}
+
+void trace_end(const char *name, uint64_t start, int ply) {
+  if (!trace) {
+    return;
+  }
+
+  if (!traceTid) {
+    traceTid = syscall(SYS_gettid);
+  }
+
+  size_t slot = atomic_fetch_add_explicit(&trace->next, 1, memory_order_relaxed);
+  TraceEvent *event = &trace->events[slot % trace->capacity];
+  event->name = name;
+  event->start = start;
+  event->end = trace_clock();
+  event->ply = ply;
+  event->tid = traceTid;
+}
+
+// Allocation accounting: the records, edit copies and file buffers of the session are
+// allocated through the counted_ functions, which keep the counts of the operation that
+// is running (a main menu option). Each block starts with its size, so frees are counted
+// in bytes too.
+typedef enum {
+  OP_OTHER,
+  OP_INSERT,
+  OP_REPLAY,
+  OP_EDIT,
+  OP_LOAD,
+  OP_SAVE,
+  OP_CLEAR,
+  OP_COUNT,
+} Operation;
+
+const char *OPERATION_NAMES[OP_COUNT] = {"other", "insert", "replay", "edit", "load", "save", "clear"};
+
+typedef struct {
+  uint64_t runs;
+  uint64_t allocs;
+  uint64_t reallocs;
+  uint64_t frees;
+  uint64_t bytes; // allocated, reallocs count the new size
+  uint64_t peakLive; // most bytes live at once while the operation ran
+  long peakRss; // kB
+} AllocStats;
+
+// a 16 byte header keeps the alignment malloc gives
+typedef union {
+  size_t size;
+  max_align_t align;
+} AllocHeader;
+
+AllocStats allocStats[OP_COUNT];
+Operation currentOperation = OP_OTHER;
+uint64_t liveBytes;
+pthread_mutex_t allocLock = PTHREAD_MUTEX_INITIALIZER;
+
+void count_allocation(size_t oldSize, size_t newSize, int isRealloc) {
+  AllocStats *stats = &allocStats[currentOperation];
+
+  pthread_mutex_lock(&allocLock);
+  if (isRealloc) {
+    stats->reallocs++;
+  } else if (newSize || !oldSize) {
+    stats->allocs++;
+  } else {
+    stats->frees++;
+  }
+  stats->bytes += newSize;
+  liveBytes += newSize - oldSize;
+  if (liveBytes > stats->peakLive) {
+    stats->peakLive = liveBytes;
+  }
+  pthread_mutex_unlock(&allocLock);
+}
+
+void *counted_malloc(size_t size) {
+  AllocHeader *header = malloc(sizeof(AllocHeader) + size);
+
+  if (!header) {
+    return NULL;
+  }
+  header->size = size;
+  count_allocation(0, size, 0);
+  return header + 1;
+}
+
+void *counted_calloc(size_t count, size_t size) {
+  void *block = count && size > SIZE_MAX / count ? NULL : counted_malloc(count * size);
+
+  if (block) {
+    memset(block, 0, count * size);
+  }
+  return block;
+}
+
+void *counted_realloc(void *block, size_t size) {
+  if (!block) {
+    return counted_malloc(size);
+  }
+
+  AllocHeader *header = (AllocHeader *) block - 1;
+  size_t oldSize = header->size;
+
+  header = realloc(header, sizeof(AllocHeader) + size);
+  if (!header) {
+    return NULL;
+  }
+  header->size = size;
+  count_allocation(oldSize, size, 1);
+  return header + 1;
+}
+
+void counted_free(void *block) {
+  if (!block) {
+    return;
+  }
+
+  AllocHeader *header = (AllocHeader *) block - 1;
+  count_allocation(header->size, 0, 0);
+  free(header);
+}
+
+// Peak resident set size in kB: the high water mark since reset_peak_rss where
+// /proc allows resetting it, since the start otherwise
+long peak_rss(void) {
+  char line[128];
+  long kb = -1;
+  FILE *fp = fopen("/proc/self/status", "r");
+
+  while (fp && fgets(line, sizeof(line), fp)) {
+    if (sscanf(line, "VmHWM: %ld", &kb) == 1) {
+      break;
+    }
+  }
+  if (fp) {
+    fclose(fp);
+  }
+
+  if (kb < 0) {
+    struct rusage usage;
+    kb = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+  }
+  return kb;
+}
+
+void reset_peak_rss(void) {
+  int fd = open("/proc/self/clear_refs", O_WRONLY);
+
+  if (fd >= 0) {
+    if (write(fd, "5", 1) != 1) {
+      // older kernels: VmHWM stays the peak since the start
+    }
+    close(fd);
+  }
+}
+
+void begin_operation(Operation operation) {
+  reset_peak_rss();
+  pthread_mutex_lock(&allocLock);
+  currentOperation = operation;
+  allocStats[operation].runs++;
+  if (liveBytes > allocStats[operation].peakLive) {
+    allocStats[operation].peakLive = liveBytes;
+  }
+  pthread_mutex_unlock(&allocLock);
+}
+
+void end_operation(void) {
+  long rss = peak_rss();
+
+  pthread_mutex_lock(&allocLock);
+  if (rss > allocStats[currentOperation].peakRss) {
+    allocStats[currentOperation].peakRss = rss;
+  }
+  currentOperation = OP_OTHER;
+  pthread_mutex_unlock(&allocLock);
+}
+
+void memory_report(void) {
+  pthread_mutex_lock(&allocLock);
+  printf("\n%-8s %6s %8s %8s %8s %12s %12s %12s\n", "", "runs", "allocs", "reallocs", "frees", "bytes", "peak live",
+         "peak RSS kB");
+  for (int i = 1; i < OP_COUNT; i++) {
+    AllocStats *stats = &allocStats[i];
+    printf("%-8s %6llu %8llu %8llu %8llu %12llu %12llu %12ld\n", OPERATION_NAMES[i], (unsigned long long) stats->runs,
+           (unsigned long long) stats->allocs, (unsigned long long) stats->reallocs, (unsigned long long) stats->frees,
+           (unsigned long long) stats->bytes, (unsigned long long) stats->peakLive, stats->peakRss);
+  }
+  printf("\n%llu bytes are allocated now\n\n", (unsigned long long) liveBytes);
+  pthread_mutex_unlock(&allocLock);
+}
+
+// Session arena: the game record and the copies the editor works on are bumped out of
+// chunks that live as long as the session. Clearing the record or starting a new game
+// rewinds the arena instead of freeing block by block. Only the main thread uses it.
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+typedef struct ArenaChunk {
+  struct ArenaChunk *next;
+  size_t capacity;
+  size_t used;
+  _Alignas(max_align_t) unsigned char data[];
+} ArenaChunk;
+
+typedef struct {
+  ArenaChunk *first;
+  ArenaChunk *current;
+  AllocHeader *last; // the newest block can grow, shrink and be freed in place
+} Arena;
+
+Arena sessionArena;
+
+size_t arena_block_size(size_t size) {
+  return sizeof(AllocHeader) + (size + sizeof(AllocHeader) - 1) / sizeof(AllocHeader) * sizeof(AllocHeader);
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+  size_t need = arena_block_size(size);
+  ArenaChunk *chunk = arena->current;
+
+  // after a reset the chunks behind the current one are reused as they come
+  while (chunk && chunk->used + need > chunk->capacity) {
+    chunk = chunk->next;
+    if (chunk) {
+      chunk->used = 0;
+    }
+  }
+
+  if (!chunk) {
+    // twice the block, so a record growing past the chunk size gets room to keep growing
+    size_t capacity = 2 * need > ARENA_CHUNK_SIZE ? 2 * need : ARENA_CHUNK_SIZE;
+
+    if (!(chunk = counted_malloc(sizeof(ArenaChunk) + capacity))) {
+      return NULL;
+    }
+    chunk->capacity = capacity;
+    chunk->used = 0;
+    if (arena->current) {
+      chunk->next = arena->current->next;
+      arena->current->next = chunk;
+    } else {
+      chunk->next = NULL;
+      arena->first = chunk;
+    }
+  }
+
+  AllocHeader *header = (AllocHeader *) (chunk->data + chunk->used);
+  header->size = size;
+  chunk->used += need;
+  arena->current = chunk;
+  arena->last = header;
+  return header + 1;
+}
+
+void arena_free(Arena *arena, void *block) {
+  AllocHeader *header = (AllocHeader *) block - 1;
+
+  if (block && header == arena->last) {
+    arena->current->used = (unsigned char *) header - arena->current->data;
+    arena->last = NULL;
+  }
+}
+
+void *arena_realloc(Arena *arena, void *block, size_t size) {
+  if (!block) {
+    return arena_alloc(arena, size);
+  }
+
+  AllocHeader *header = (AllocHeader *) block - 1;
+  size_t offset = (unsigned char *) header - arena->current->data;
+
+  if (header == arena->last && offset + arena_block_size(size) <= arena->current->capacity) {
+    arena->current->used = offset + arena_block_size(size);
+    header->size = size;
+    return block;
+  }
+  if (size <= header->size) {
+    header->size = size;
+    return block;
+  }
+
+  // the old block stays where it is until the arena is reset
+  void *moved = arena_alloc(arena, size);
+  if (moved) {
+    memcpy(moved, block, header->size);
+  }
+  return moved;
+}
+
+void arena_reset(Arena *arena) {
+  if (arena->first) {
+    arena->first->used = 0;
+  }
+  arena->current = arena->first;
+  arena->last = NULL;
+}
+
+// Drops the record of the session along with everything else in the arena
+void reset_session(Move **moves) {
+  *moves = NULL;
+  arena_reset(&sessionArena);
+}
+
+// GameState pool: snapshots come from per-thread free lists of cache line aligned
+// blocks, refilled STATE_POOL_BATCH blocks at a time. A block may be released on
+// another thread than the one that acquired it, it just joins that thread's list.
+#define STATE_POOL_BATCH 64
+
+typedef struct PooledState {
+  union {
+    struct PooledState *next;
+    GameState state;
+  };
+} __attribute__((aligned(64))) PooledState;
+
+typedef struct StateChunk {
+  struct StateChunk *next;
+  PooledState states[STATE_POOL_BATCH];
+} StateChunk;
+
+_Thread_local PooledState *statePool;
+StateChunk *stateChunks; // every chunk ever allocated, they are never returned
+pthread_mutex_t stateChunksLock = PTHREAD_MUTEX_INITIALIZER;
+
+int state_pool_refill(void) {
+  StateChunk *chunk = aligned_alloc(_Alignof(StateChunk), sizeof(StateChunk));
+
+  if (!chunk) {
+    return 0;
+  }
+
+  pthread_mutex_lock(&stateChunksLock);
+  chunk->next = stateChunks;
+  stateChunks = chunk;
+  pthread_mutex_unlock(&stateChunksLock);
+
+  for (int i = 0; i < STATE_POOL_BATCH; i++) {
+    chunk->states[i].next = statePool;
+    statePool = &chunk->states[i];
+  }
+  return 1;
+}
+
+// Fills states with count blocks, returns 0 (and acquires none) when out of memory
+int state_acquire_bulk(GameState **states, int count) {
+  PooledState *list = NULL;
+
+  for (int i = 0; i < count; i++) {
+    if (!statePool && !state_pool_refill()) {
+      // put back what was taken so far
+      while (list) {
+        PooledState *next = list->next;
+        list->next = statePool;
+        statePool = list;
+        list = next;
+      }
+      return 0;
+    }
+    PooledState *block = statePool;
+    statePool = block->next;
+    block->next = list;
+    list = block;
+    states[i] = &block->state;
+  }
+  return 1;
+}
+
+GameState *state_acquire(void) {
+  GameState *state;
+  return state_acquire_bulk(&state, 1) ? state : NULL;
+}
+
+void state_release_bulk(GameState **states, int count) {
+  for (int i = 0; i < count; i++) {
+    if (states[i]) {
+      PooledState *block = (PooledState *) states[i];
+      block->next = statePool;
+      statePool = block;
+    }
+  }
+}
+
+void state_release(GameState *state) {
+  state_release_bulk(&state, 1);
+}
+
+int modify_memory(Move **moves, int gameLength, int mod) {
+  if (gameLength + mod) {
+    Move *temp;
+    temp = arena_realloc(&sessionArena, *moves, (gameLength + mod) * sizeof(Move));
+    if (!temp) {
+      return 0;
+    }
+    *moves = temp;
+    return 1;
+  } else {
+    arena_free(&sessionArena, *moves);
+    *moves = NULL;
+    return 1;
+  }
+}
+
+void free_memory(Move **moves) {
+	arena_free(&sessionArena, *moves);
+	*moves = NULL;
+}
+
+// Zobrist keys: one random number per (piece code, square) and one for black to move
+uint64_t ZOBRIST[16][64];
+uint64_t ZOBRIST_BLACK_TO_MOVE;
+pthread_once_t zobristOnce = PTHREAD_ONCE_INIT;
+
+void init_zobrist(void) {
+  uint64_t seed = 0x2545f4914f6cdd1d;
+
+  // row 0 (empty square) stays zero so empty squares don't change the key
+  for (int code = 1; code < 16; code++) {
+    for (int square = 0; square < 64; square++) {
+      seed ^= seed << 13;
+      seed ^= seed >> 7;
+      seed ^= seed << 17;
+      ZOBRIST[code][square] = seed;
+    }
+  }
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  ZOBRIST_BLACK_TO_MOVE = seed;
+}
+
+// Pawns that already moved can't make the two square step, so they hash differently
+int zobrist_piece(Piece piece) {
+  if (piece.type == EMPTY) {
+    return 0;
+  }
+  if (piece.type == PAWN && piece.hasMoved) {
+    return piece.color == BLACK ? 14 : 7;
+  }
+  return (piece.color == BLACK ? 7 : 0) + piece.type;
+}
+
+uint64_t position_key(GameState *state) {
+  uint64_t key;
+
+  pthread_once(&zobristOnce, init_zobrist);
+  key = state->whiteToMove ? 0 : ZOBRIST_BLACK_TO_MOVE;
+
+  for (int i = 0; i < 8; i++) {
+    for (int j = 0; j < 8; j++) {
+      key ^= ZOBRIST[zobrist_piece(state->board[i][j])][i * 8 + j];
+    }
+  }
+
+  return key;
+}
+
+void initializeBoard(GameState *state) {
+  // Set all board positions to EMPTY and color to NONE
+  for (int i = 0; i < 8; i++) {
+    for (int j = 0; j < 8; j++) {
+        state->board[i][j] = EMPTY_PIECE;
+    }
+  }
+
+  // Set up the white pieces
+  state->board[0][0].type = ROOK;
+  state->board[0][1].type = KNIGHT;
+  state->board[0][2].type = BISHOP;
+  state->board[0][3].type = QUEEN;
+  state->board[0][4].type = KING;
+  state->board[0][5].type = BISHOP;
+  state->board[0][6].type = KNIGHT;
+  state->board[0][7].type = ROOK;
+  for (int i = 0; i < 8; i++) {
+    state->board[0][i].color = BLACK;
+    state->board[1][i].color = BLACK;
+    state->board[1][i].type = PAWN;
+  }
+
+  // Set up the black pieces
+  state->board[7][0].type = ROOK;
+  state->board[7][1].type = KNIGHT;
+  state->board[7][2].type = BISHOP;
+  state->board[7][3].type = QUEEN;
+  state->board[7][4].type = KING;
+  state->board[7][5].type = BISHOP;
+  state->board[7][6].type = KNIGHT;
+  state->board[7][7].type = ROOK;
+  for (int i = 0; i < 8; i++) {
+    state->board[6][i].color = WHITE;
+    state->board[7][i].color = WHITE;
+    state->board[6][i].type = PAWN;
+  }
+
+  // Set other state information
+  state->whiteToMove = 1;
+  state->whiteKingPos[0] = 7;
+  state->whiteKingPos[1] = 4;
+  state->blackKingPos[0] = 0;
+  state->blackKingPos[1] = 4;
+  // no castling rights: FENs written from here describe this variant, which can't castle
+  state->castling = 0;
+  state->enPassant = -1;
+  state->halfmoveClock = 0;
+  state->fullmoveNumber = 1;
+  state->key = position_key(state);
+}
+
+void initializeTestBoard(GameState *state) {
+  for (int i = 0; i < 8; i++) {
+    for (int j = 0; j < 8; j++) {
+      state->board[i][j] = EMPTY_PIECE;
+    }
+  }
+
+  state->board[7][3].type = KING;
+  state->board[7][3].color = WHITE;
+  state->board[0][3].type = KING;
+  state->board[0][3].color = BLACK;
+
+  state->board[0][0].type = ROOK;
+  state->board[0][0].color = BLACK;
+
+  state->board[0][1].type = BISHOP;
+  state->board[0][1].color = BLACK;
+
+  state->board[0][2].type = KNIGHT;
+  state->board[0][2].color = BLACK;
+
+  state->whiteToMove = 1;
+  state->whiteKingPos[0] = 7;
+  state->whiteKingPos[1] = 3;
+  state->blackKingPos[0] = 0;
+  state->blackKingPos[1] = 3;
+  state->castling = 0;
+  state->enPassant = -1;
+  state->halfmoveClock = 0;
+  state->fullmoveNumber = 1;
+  state->key = position_key(state);
+}
+
+// FEN piece letters, uppercase for white
+const char FEN_PIECES[] = " PRNBQK";
+// the longest FEN dumpFen writes (both clocks at INT_MAX) is 105 characters
+#define FEN_SIZE 112
+
+// Loads a position in Forsyth-Edwards notation; returns 0 if it is malformed or
+// doesn't have exactly one king per side (state is left undefined then)
+int loadFen(GameState *state, const char *fen) {
+  int rank = 0, file = 0, whiteKings = 0, blackKings = 0;
+  const char *c = fen;
+
+  for (int i = 0; i < 8; i++) {
+    for (int j = 0; j < 8; j++) {
+      state->board[i][j] = EMPTY_PIECE;
+    }
+  }
+
+  for (; *c && *c != ' '; c++) {
+    if (*c == '/') {
+      if (file != 8 || ++rank > 7) {
+        return 0;
+      }
+      file = 0;
+    } else if (*c >= '1' && *c <= '8') {
+      file += *c - '0';
+    } else {
+      const char *letter = strchr(FEN_PIECES + 1, toupper(*c));
+      if (!letter || file > 7) {
+        return 0;
+      }
+      Piece *piece = &state->board[rank][file];
+      piece->type = letter - FEN_PIECES;
+      piece->color = isupper(*c) ? WHITE : BLACK;
+      if (piece->type == KING && piece->color == WHITE) {
+        state->whiteKingPos[0] = rank;
+        state->whiteKingPos[1] = file;
+        whiteKings++;
+      } else if (piece->type == KING) {
+        state->blackKingPos[0] = rank;
+        state->blackKingPos[1] = file;
+        blackKings++;
+      }
+      // a pawn off its starting rank can't make the two square step any more
+      piece->hasMoved = piece->type == PAWN && rank != (piece->color == WHITE ? 6 : 1);
+      file++;
+    }
+    if (file > 8) {
+      return 0;
+    }
+  }
+
+  if (rank != 7 || file != 8 || whiteKings != 1 || blackKings != 1 || *c++ != ' ') {
+    return 0;
+  }
+
+  if (*c != 'w' && *c != 'b') {
+    return 0;
+  }
+  state->whiteToMove = *c++ == 'w';
+
+  // the rest is optional, missing fields get the initial values
+  state->castling = 0;
+  state->enPassant = -1;
+  state->halfmoveClock = 0;
+  state->fullmoveNumber = 1;
+
+  while (*c == ' ') {
+    c++;
+  }
+  for (; *c && *c != ' '; c++) {
+    switch (*c) {
+      case 'K':
+        state->castling |= CASTLE_WHITE_KING;
+        break;
+      case 'Q':
+        state->castling |= CASTLE_WHITE_QUEEN;
+        break;
+      case 'k':
+        state->castling |= CASTLE_BLACK_KING;
+        break;
+      case 'q':
+        state->castling |= CASTLE_BLACK_QUEEN;
+        break;
+      case '-':
+        break;
+      default:
+        return 0;
+    }
+  }
+
+  while (*c == ' ') {
+    c++;
+  }
+  if (*c >= 'a' && *c <= 'h' && c[1] >= '1' && c[1] <= '8') {
+    state->enPassant = ('8' - c[1]) * 8 + c[0] - 'a';
+    c += 2;
+  } else if (*c == '-') {
+    c++;
+  } else if (*c) {
+    return 0;
+  }
+
+  if (*c) {
+    char *end;
+    errno = 0;
+    long halfmove = strtol(c, &end, 10);
+    long fullmove = end != c ? strtol(end, NULL, 10) : 1;
+    if (errno || halfmove < 0 || halfmove > INT_MAX || fullmove > INT_MAX) {
+      return 0;
+    }
+    state->halfmoveClock = halfmove;
+    state->fullmoveNumber = fullmove < 1 ? 1 : fullmove;
+  }
+
+  state->key = position_key(state);
+  return 1;
+}
+
+// Writes the position in Forsyth-Edwards notation into fen of the given size (FEN_SIZE
+// always fits); returns the length like snprintf, so a result >= size means it was cut
+int dumpFen(GameState *state, char *fen, size_t size) {
+  char text[FEN_SIZE];
+  char *out = text;
+
+  for (int i = 0; i < 8; i++) {
+    int empty = 0;
+    for (int j = 0; j < 8; j++) {
+      Piece piece = state->board[i][j];
+      if (piece.type == EMPTY) {
+        empty++;
+        continue;
+      }
+      if (empty) {
+        *out++ = '0' + empty;
+        empty = 0;
+      }
+      *out++ = piece.color == WHITE ? FEN_PIECES[piece.type] : tolower(FEN_PIECES[piece.type]);
+    }
+    if (empty) {
+      *out++ = '0' + empty;
+    }
+    if (i < 7) {
+      *out++ = '/';
+    }
+  }
+
+  *out++ = ' ';
+  *out++ = state->whiteToMove ? 'w' : 'b';
+  *out++ = ' ';
+
+  if (!state->castling) {
+    *out++ = '-';
+  }
+  if (state->castling & CASTLE_WHITE_KING) {
+    *out++ = 'K';
+  }
+  if (state->castling & CASTLE_WHITE_QUEEN) {
+    *out++ = 'Q';
+  }
+  if (state->castling & CASTLE_BLACK_KING) {
+    *out++ = 'k';
+  }
+  if (state->castling & CASTLE_BLACK_QUEEN) {
+    *out++ = 'q';
+  }
+
+  *out++ = ' ';
+  if (state->enPassant < 0) {
+    *out++ = '-';
+  } else {
+    *out++ = 'a' + state->enPassant % 8;
+    *out++ = '8' - state->enPassant / 8;
+  }
+
+  *out = '\0';
+  return snprintf(fen, size, "%s %d %d", text, state->halfmoveClock, state->fullmoveNumber);
+}
+
+int parseMove(char *move) {
+  uint64_t traceStart = trace_begin();
+
+  if (!(tolower(move[0]) >= 'a' && tolower(move[0]) <= 'h' &&
+      tolower(move[2]) >= 'a' && tolower(move[2]) <= 'h' &&
+      move[1] >= '1' && move[1] <= '8' &&
+      move[3] >= '1' && move[3] <= '8') ||
+      !move || !(move + 1) || !(move + 2) || !(move + 3)) {
+        trace_end("parse", traceStart, 0);
+        return 0;
+  }
+  
+  move[0] = tolower(move[0]) - 'a';
+  move[1] = 8 - (move[1] - '0');
+  move[2] = tolower(move[2]) - 'a';
+  move[3] = 8 - (move[3] - '0');
+
+  trace_end("parse", traceStart, 0);
+  return 1;
+}
+
+Type promotionFromChar(char c) {
+  switch (tolower(c)) {
+    case 'q':
+      return QUEEN;
+    case 'b':
+      return BISHOP;
+    case 'n':
+      return KNIGHT;
+    case 'r':
+      return ROOK;
+    default:
+      return EMPTY;
+  }
+}
+
+char promotionToChar(int type) {
+  switch (type) {
+    case QUEEN:
+      return 'q';
+    case BISHOP:
+      return 'b';
+    case KNIGHT:
+      return 'n';
+    case ROOK:
+      return 'r';
+    default:
+      return '\0';
+  }
+}
+
+// move[4] is an optional promotion letter (e7e8q), left untouched by parseMove
+void load_move(char *move, Move *moves) {
+	moves->fromFile = move[0];
+	moves->fromRank = move[1];
+	moves->toFile = move[2];
+	moves->toRank = move[3];
+	moves->promotion = promotionFromChar(move[4]);
+}
+
+Piece checkTileForPiece(GameState *state, int fromRank, int fromFile, int verOffset, int horOffset, int verLim, int horLim) {
+  PROFILE_SCOPE(PROF_CHECK_TILE);
+  if (fromRank + verOffset >= 8 || fromRank + verOffset < 0 ||
+      fromFile + horOffset >= 8 || fromFile + horOffset < 0 ||
+      fromRank + verOffset == verLim || fromFile + horOffset == horLim) {
+    return EMPTY_PIECE;
+  } else if (state->board[fromRank + verOffset][fromFile + horOffset].type != EMPTY) {
+    return state->board[fromRank + verOffset][fromFile + horOffset];
+  } else {
+    return checkTileForPiece(state, fromRank + verOffset, fromFile + horOffset, verOffset, horOffset, verLim, horLim);
+  }
+}
+
+// messages printed under the board may scroll it, the next frame is drawn whole then
+void invalidate_frame(void);
+
+void moveInBoard(GameState *state, Move *move, Piece *piece) {
+  PROFILE_SCOPE(PROF_MOVE_IN_BOARD);
+  int fromFile = move->fromFile, fromRank = move->fromRank, toFile = move->toFile, toRank = move->toRank;
+  char prom;
+  int resetsClock = piece->type == PAWN || state->board[toRank][toFile].type != EMPTY;
+
+  piece->hasMoved = 1;
+
+  // FEN bookkeeping; the corners are where the rooks start
+  state->enPassant = piece->type == PAWN && abs(toRank - fromRank) == 2 ? (fromRank + toRank) / 2 * 8 + fromFile : -1;
+  state->halfmoveClock = resetsClock ? 0 : state->halfmoveClock + 1;
+  if (!state->whiteToMove) {
+    state->fullmoveNumber++;
+  }
+  if (piece->type == KING) {
+    state->castling &= state->whiteToMove ? ~(CASTLE_WHITE_KING | CASTLE_WHITE_QUEEN) : ~(CASTLE_BLACK_KING | CASTLE_BLACK_QUEEN);
+  }
+  for (int i = 0; i < 2; i++) {
+    int rank = i ? toRank : fromRank, file = i ? toFile : fromFile;
+    if (rank == 7 && file == 7) {
+      state->castling &= ~CASTLE_WHITE_KING;
+    } else if (rank == 7 && file == 0) {
+      state->castling &= ~CASTLE_WHITE_QUEEN;
+    } else if (rank == 0 && file == 7) {
+      state->castling &= ~CASTLE_BLACK_KING;
+    } else if (rank == 0 && file == 0) {
+      state->castling &= ~CASTLE_BLACK_QUEEN;
+    }
+  }
+
+  // the choice is stored in the move, so the record replays without asking again
+  if (piece->type == PAWN && (toRank == 0 || toRank == 7)) {
+    if (move->promotion == EMPTY && !interactive) {
+      move->promotion = QUEEN;
+    } else if (move->promotion == EMPTY) {
+      invalidate_frame();
+      printf("A pawn is promoted, enter its type: q (queen), b (bishop), n (knight), r (rook)\n> ");
+      while (scanf(" %c", &prom) == 1) {
+        move->promotion = promotionFromChar(prom);
+        if (move->promotion != EMPTY) break;
+        printf("Wrong input. Try again...\n> ");
+        fflush(stdin);
+      }
+    }
+    if (move->promotion != EMPTY) {
+      piece->type = move->promotion;
+    }
+  }
+
+  if (piece->type == KING && state->whiteToMove) {
+    state->whiteKingPos[0] = toRank;
+    state->whiteKingPos[1] = toFile;
+  } else if (piece->type == KING && !state->whiteToMove) {
+    state->blackKingPos[0] = toRank;
+    state->blackKingPos[1] = toFile;
+  }
+
+  state->key ^= ZOBRIST[zobrist_piece(state->board[fromRank][fromFile])][fromRank * 8 + fromFile] ^
+                ZOBRIST[zobrist_piece(state->board[toRank][toFile])][toRank * 8 + toFile] ^
+                ZOBRIST[zobrist_piece(*piece)][toRank * 8 + toFile] ^
+                ZOBRIST_BLACK_TO_MOVE;
+
+  state->board[toRank][toFile] = *piece;
+  state->board[fromRank][fromFile] = EMPTY_PIECE;
+
+  state->whiteToMove = !state->whiteToMove;
+}
+
+// squares next to the king may be off the board
+int hasPieceAt(GameState *state, int rank, int file, Type type, int color) {
+  return rank >= 0 && rank < 8 && file >= 0 && file < 8 &&
+         state->board[rank][file].type == type && state->board[rank][file].color == color;
+}
+
+int isCheck(GameState *oldState, Move *move, Piece *oldPiece) {
+  PROFILE_SCOPE(PROF_IS_CHECK);
+  int fromFile = move->fromFile, fromRank = move->fromRank, toFile = move->toFile, toRank = move->toRank;
+  int checkRank, checkFile, white, oppositeColor;
+
+  GameState state = *oldState;
+  Piece piece = *oldPiece;
+
+  // make hypothetical move in temporary board with temporary piece
+  moveInBoard(&state, move, &piece);
+
+  // Pawn check can only be in one direction so it has
+  // to be checked by different offsets for each side
+
+  white = oldState->whiteToMove ? 1 : 0;
+  if (white) {
+    checkRank = state.whiteKingPos[0];
+    checkFile = state.whiteKingPos[1];
+    oppositeColor = BLACK;
+
+    // pawn check for white
+    if (hasPieceAt(&state, checkRank - 1, checkFile + 1, PAWN, oppositeColor) ||
+        hasPieceAt(&state, checkRank - 1, checkFile - 1, PAWN, oppositeColor)) {
+      return 1;
+    }
+
+  } else {
+    checkRank = state.blackKingPos[0];
+    checkFile = state.blackKingPos[1];
+    oppositeColor = WHITE;
+
+    // pawn check for black
+    if (hasPieceAt(&state, checkRank + 1, checkFile + 1, PAWN, oppositeColor) ||
+        hasPieceAt(&state, checkRank + 1, checkFile - 1, PAWN, oppositeColor)) {
+      return 1;
+    }
+  }
+
+  // the limits are off the board, so each scan runs to the first piece or the edge
+  Piece vPosRook = checkTileForPiece(&state, checkRank, checkFile, 1, 0, -1, -1);
+  if ((vPosRook.type == ROOK || vPosRook.type == QUEEN) && vPosRook.color == oppositeColor) {
+    return 1;
+  }
+
+  Piece vNegRook = checkTileForPiece(&state, checkRank, checkFile, -1, 0 , -1, -1);
+  if ((vNegRook.type == ROOK || vNegRook.type == QUEEN) && vNegRook.color == oppositeColor) {
+    return 1;
+  }
+
+  Piece hPosRook = checkTileForPiece(&state, checkRank, checkFile, 0, 1, -1, -1);
+  if ((hPosRook.type == ROOK || hPosRook.type == QUEEN) && hPosRook.color == oppositeColor) {
+    return 1;
+  }
+
+  Piece hNegRook = checkTileForPiece(&state, checkRank, checkFile, 0, -1, -1, -1);
+  if ((hNegRook.type == ROOK || hNegRook.type == QUEEN) && hNegRook.color == oppositeColor) {
+    return 1;
+  }
+
+  Piece vPosBishop = checkTileForPiece(&state, checkRank, checkFile, 1, 1, -1, -1);
+  if ((vPosBishop.type == BISHOP || vPosBishop.type == QUEEN) && vPosBishop.color == oppositeColor) {
+    return 1;
+  }
+
+  Piece vNegBishop = checkTileForPiece(&state, checkRank, checkFile, -1, -1, -1, -1);
+  if ((vNegBishop.type == BISHOP || vNegBishop.type == QUEEN) && vNegBishop.color == oppositeColor) {
+    return 1;
+  }
+
+  Piece hPosBishop = checkTileForPiece(&state, checkRank, checkFile, -1, 1, -1, -1);
+  if ((hPosBishop.type == BISHOP || hPosBishop.type == QUEEN) && hPosBishop.color == oppositeColor) {
+    return 1;
+  }
+
+  Piece hNegBishop = checkTileForPiece(&state, checkRank, checkFile, 1, -1, -1, -1);
+  if ((hNegBishop.type == BISHOP || hNegBishop.type == QUEEN) && hNegBishop.color == oppositeColor) {
+    return 1;
+  }
+
+  int knightOffsets[8][2] = {
+    {-2, 1}, {-1, 2}, {1, 2}, {2, 1},
+    {2, -1}, {1, -2}, {-1, -2}, {-2, -1},
+  };
+
+  for (int i = 0; i < 8; i++) {
+    if (hasPieceAt(&state, checkRank + knightOffsets[i][0], checkFile + knightOffsets[i][1], KNIGHT, oppositeColor)) {
+      return 1;
+    }
+  }
+
+  // the other king covers the squares around it, so the kings can't end up side by side
+  for (int rank = -1; rank <= 1; rank++) {
+    for (int file = -1; file <= 1; file++) {
+      if ((rank || file) && hasPieceAt(&state, checkRank + rank, checkFile + file, KING, oppositeColor)) {
+        return 1;
+      }
+    }
+  }
+
+	return 0;
+}
+
+int isLegalRookMove(GameState *state, Move *move) {
+  int fromFile = move->fromFile, fromRank = move->fromRank, toFile = move->toFile, toRank = move->toRank;
+  if (fromFile != toFile &&  fromRank != toRank) {
+    return 0;
+  }
+
+  int vertical = fromFile - toFile == 0 ? 1 : 0;
+
+  int verOffset = 0, horOffset = 0;
+
+  if (vertical) {
+    verOffset = 1;
+    if (fromRank - toRank > 0) {
+      verOffset = -1;
+    }
+
+    Piece moveSquare = checkTileForPiece(state, fromRank, fromFile, verOffset, horOffset, toRank, -1);
+    if (moveSquare.type != EMPTY) {
+      return 0;
+    }
+  } else {
+    horOffset = 1;
+    if (fromFile - toFile > 0) {
+      horOffset = -1;
+    }
+
+    Piece moveSquare = checkTileForPiece(state, fromRank, fromFile, verOffset, horOffset, -1, toFile);
+    if (moveSquare.type != EMPTY) {
+      return 0;
+    }
+  }
+  
+  return 1;
+}
+
+int isLegalBishopMove(GameState *state, Move *move) {
+  int fromFile = move->fromFile, fromRank = move->fromRank, toFile = move->toFile, toRank = move->toRank;
+  if (abs(fromFile - toFile) != abs(fromRank - toRank)) {
+    return 0;
+  }
+
+  // vertical if a8 h1 diagonal; horizontal is a1 h8 diagonal
+  int rankOffset = 1, fileOffset = 1, vertical = ((fromRank - toRank) ^ (fromFile - toFile)) >= 0 ? 1 : 0;
+
+  if (vertical) {
+    if (fromRank - toRank > 0) {
+      rankOffset = -1;
+      fileOffset = -1;
+    }
+  } else {
+    if (fromRank - toRank > 0) {
+      rankOffset = -1;
+    } else {
+      fileOffset = -1;
+    }
+  }
+
+  Piece moveSquare = checkTileForPiece(state, fromRank, fromFile, rankOffset, fileOffset, toRank, toFile);
+  if (moveSquare.type != EMPTY) {
+    return 0;
+  }
+
+  return 1;
+}
+
+int isLegalKnightMove(GameState *state, Move *move) {
+  int fromFile = move->fromFile, fromRank = move->fromRank, toFile = move->toFile, toRank = move->toRank;
+
+  if (abs(fromFile - toFile) == 2 && abs(fromRank - toRank) == 1 ||
+      abs(fromFile - toFile) == 1 && abs(fromRank - toRank) == 2) {
+    return 1;
+  }
+
+  return 0;
+}
+
+int isLegalPawnMove(GameState *state, Move *move) {
+  int fromFile = move->fromFile, fromRank = move->fromRank, toFile = move->toFile, toRank = move->toRank;
+  int rankDiff = fromRank - toRank, fileDiff = fromFile - toFile;
+  int whiteToMove = state->whiteToMove;
+
+  if ((whiteToMove && rankDiff < 0 || !whiteToMove && rankDiff > 0) ||
+      (fileDiff == 0 && state->board[toRank][toFile].type != EMPTY) || // cant take not diagonally
+      (abs(fileDiff) == 1 && abs(rankDiff) == 2) || // cant take skipping a square of the first move
+      (abs(fileDiff) == 1 && rankDiff == 0) ||
+      (abs(fileDiff) == 1 && state->board[toRank][toFile].type == EMPTY) || // can move diagonally only if can take
+      abs(fileDiff) > 1 || abs(rankDiff) > 2 || // max move range 
+      (abs(rankDiff) == 2 && state->board[fromRank][fromFile].hasMoved) || // two squares step
+      (abs(rankDiff) == 2 && state->board[(fromRank + toRank) / 2][fromFile].type != EMPTY)) { // cant jump
+    return 0;
+  }
+
+	return 1;
+}
+
+int isLegalKingMove(GameState *state, Move *move) {
+  int fromFile = move->fromFile, fromRank = move->fromRank, toFile = move->toFile, toRank = move->toRank;
+
+  if (abs(fromFile - toFile) > 1 || abs(fromRank - toRank) > 1 ||
+      (abs(fromRank - toFile) == 0 && abs(fromRank - toRank) == 0)) {
+    return 0;
+  }
+
+	return 1;
+}
+
+int isLegalMove(GameState *state, Move *move) {
+  PROFILE_SCOPE(PROF_IS_LEGAL_MOVE);
+  int legal;
+  int fromFile = move->fromFile, fromRank = move->fromRank, toFile = move->toFile, toRank = move->toRank;
+
+  switch (state->board[fromRank][fromFile].type) {
+    case ROOK:
+      legal = isLegalRookMove(state, move);
+      break;
+    case BISHOP:
+      legal = isLegalBishopMove(state, move);
+      break;
+    case QUEEN:
+      legal = isLegalRookMove(state, move) || isLegalBishopMove(state, move);
+      break;
+    case KNIGHT:
+      legal = isLegalKnightMove(state, move);
+      break;
+    case PAWN:
+      legal = isLegalPawnMove(state, move);
+      break;
+    case KING:
+      legal = isLegalKingMove(state, move);
+      break;
+  }
+
+  return legal;
+}
+
+MoveStatus checkMove(GameState *state, Move *move) {
+  int fromFile = move->fromFile, fromRank = move->fromRank, toFile = move->toFile, toRank = move->toRank;
+
+  if (fromFile == toFile && fromRank == toRank) {
+    return MOVE_NOT_MOVED;
+  }
+
+  Piece piece = state->board[fromRank][fromFile];
+
+  // Check for empty square
+  if (piece.color == NONE || piece.type == EMPTY) {
+    return MOVE_NO_PIECE;
+  }
+
+  // Check for the right color move
+  if ((piece.color == WHITE && !state->whiteToMove) ||
+      (piece.color == BLACK && state->whiteToMove)) {
+    return MOVE_WRONG_COLOR;
+  }
+
+  uint64_t traceStart = trace_begin();
+  int legal = isLegalMove(state, move);
+  trace_end("legality", traceStart, trace_ply(state));
+
+  if (!legal) {
+    return MOVE_ILLEGAL;
+  }
+
+  if (state->board[fromRank][fromFile].color == state->board[toRank][toFile].color) {
+    return MOVE_ILLEGAL;
+  }
+
+  traceStart = trace_begin();
+  int check = isCheck(state, move, &piece);
+  trace_end("check", traceStart, trace_ply(state));
+
+  if (check) {
+    return MOVE_CHECK;
+  }
+
+  return MOVE_OK;
+}
+
+int makeMove(GameState *state, Move *move) {
+  PROFILE_SCOPE(PROF_MAKE_MOVE);
+  int fromFile = move->fromFile, fromRank = move->fromRank;
+  MoveStatus status = checkMove(state, move);
+
+  if (status != MOVE_OK) {
+    invalidate_frame();
+  }
+
+  switch (status) {
+    case MOVE_OK:
+      break;
+    case MOVE_NOT_MOVED:
+      printf("Invalid move (piece didn't move)\n> ");
+      return 0;
+    case MOVE_NO_PIECE:
+      printf("Invalid move (no piece at %c%d)\n> ", 'a' + fromFile, 8 - fromRank);
+      return 0;
+    case MOVE_WRONG_COLOR:
+      printf("Invalid move (wrong color to move)\n> ");
+      return 0;
+    case MOVE_ILLEGAL:
+      printf("Invalid move (illegal move)\n> ");
+      return 0;
+    case MOVE_CHECK:
+      printf("Invalid move (check after move)\n> ");
+      return 0;
+  }
+
+  int ply = trace_ply(state);
+  uint64_t traceStart = trace_begin();
+  Piece piece = state->board[fromRank][fromFile];
+  moveInBoard(state, move, &piece);
+  trace_end("update", traceStart, ply);
+  PROFILE_PLY();
+
+  return 1;
+}
+
+// Same checks as makeMove without the messages
+MoveStatus playMove(GameState *state, Move *move) {
+  int ply = trace_ply(state);
+  uint64_t plyStart = trace_begin();
+  MoveStatus status = checkMove(state, move);
+
+  if (status == MOVE_OK) {
+    uint64_t traceStart = trace_begin();
+    Piece piece = state->board[move->fromRank][move->fromFile];
+    moveInBoard(state, move, &piece);
+    trace_end("update", traceStart, ply);
+    PROFILE_PLY();
+  }
+
+  trace_end("ply", plyStart, ply);
+  return status;
+}
+
+// Whether the side to move is in check: isCheck with the king staying on its square
+int inCheck(GameState *state) {
+  int *king = state->whiteToMove ? state->whiteKingPos : state->blackKingPos;
+  Move stay = {king[1], king[0], king[1], king[0], EMPTY};
+  Piece piece = state->board[king[0]][king[1]];
+
+  return isCheck(state, &stay, &piece);
+}
+
+// Legal moves of a position as target bitboards (bit = rank * 8 + file). Only squares
+// with at least one legal move get an entry, in square order, so 16 entries are enough
+// for one side's pieces.
+#define LEGAL_SET_PIECES 16
+
+typedef struct {
+  uint64_t fromMask;
+  uint64_t targets[LEGAL_SET_PIECES];
+} LegalSet;
+
+int legal_set_has(const LegalSet *set, int from, int to) {
+  uint64_t bit = 1ULL << from;
+
+  if (!(set->fromMask & bit)) {
+    return 0;
+  }
+
+  return set->targets[__builtin_popcountll(set->fromMask & (bit - 1))] >> to & 1;
+}
+
+uint64_t legal_set_targets(const LegalSet *set, int from) {
+  uint64_t bit = 1ULL << from;
+
+  if (!(set->fromMask & bit)) {
+    return 0;
+  }
+
+  return set->targets[__builtin_popcountll(set->fromMask & (bit - 1))];
+}
+
+// Squares a piece could move to by its pattern alone; every move checkMove
+// accepts is among them
+uint64_t candidate_targets(Type type, int rank, int file) {
+  uint64_t targets = 0;
+  int knight[8][2] = {{-2, 1}, {-1, 2}, {1, 2}, {2, 1}, {2, -1}, {1, -2}, {-1, -2}, {-2, -1}};
+
+  for (int r = 0; r < 8; r++) {
+    for (int f = 0; f < 8; f++) {
+      int dr = abs(r - rank), df = abs(f - file), hit = 0;
+
+      switch (type) {
+        case ROOK:
+          hit = dr == 0 || df == 0;
+          break;
+        case BISHOP:
+          hit = dr == df;
+          break;
+        case QUEEN:
+          hit = dr == 0 || df == 0 || dr == df;
+          break;
+        case PAWN:
+          hit = dr <= 2 && df <= 1;
+          break;
+        case KING:
+          hit = dr <= 1 && df <= 1;
+          break;
+        default:
+          break;
+      }
+
+      if (hit) {
+        targets |= 1ULL << (r * 8 + f);
+      }
+    }
+  }
+
+  if (type == KNIGHT) {
+    for (int i = 0; i < 8; i++) {
+      int r = rank + knight[i][0], f = file + knight[i][1];
+      if (r >= 0 && r < 8 && f >= 0 && f < 8) {
+        targets |= 1ULL << (r * 8 + f);
+      }
+    }
+  }
+
+  return targets & ~(1ULL << (rank * 8 + file));
+}
+
+// Runs checkMove on every candidate of the side to move; returns 0 if more
+// squares than LEGAL_SET_PIECES have moves (only possible in made up positions)
+int generate_legal_set(GameState *state, LegalSet *set) {
+  Color color = state->whiteToMove ? WHITE : BLACK;
+  int entries = 0;
+  Move move;
+
+  memset(set, 0, sizeof(*set));
+
+  for (int rank = 0; rank < 8; rank++) {
+    for (int file = 0; file < 8; file++) {
+      Piece piece = state->board[rank][file];
+      uint64_t candidates, targets = 0;
+
+      if (piece.color != color) {
+        continue;
+      }
+
+      candidates = candidate_targets(piece.type, rank, file);
+      while (candidates) {
+        int to = __builtin_ctzll(candidates);
+        candidates &= candidates - 1;
+
+        move.fromRank = rank;
+        move.fromFile = file;
+        move.toRank = to / 8;
+        move.toFile = to % 8;
+        // the promotion piece doesn't change legality, it only has to be set to avoid the prompt
+        move.promotion = piece.type == PAWN && (move.toRank == 0 || move.toRank == 7) ? QUEEN : EMPTY;
+
+        if (checkMove(state, &move) == MOVE_OK) {
+          targets |= 1ULL << to;
+        }
+      }
+
+      if (targets) {
+        if (entries == LEGAL_SET_PIECES) {
+          return 0;
+        }
+        set->fromMask |= 1ULL << (rank * 8 + file);
+        set->targets[entries++] = targets;
+      }
+    }
+  }
+
+  return 1;
+}
+
+// Stops at the first legal move of the side to move, for mate and stalemate
+int hasLegalMove(GameState *state) {
+  Color color = state->whiteToMove ? WHITE : BLACK;
+  Move move;
+
+  for (int rank = 0; rank < 8; rank++) {
+    for (int file = 0; file < 8; file++) {
+      Piece piece = state->board[rank][file];
+
+      if (piece.color != color) {
+        continue;
+      }
+
+      uint64_t candidates = candidate_targets(piece.type, rank, file);
+      while (candidates) {
+        int to = __builtin_ctzll(candidates);
+        candidates &= candidates - 1;
+
+        move.fromRank = rank;
+        move.fromFile = file;
+        move.toRank = to / 8;
+        move.toFile = to % 8;
+        move.promotion = piece.type == PAWN && (move.toRank == 0 || move.toRank == 7) ? QUEEN : EMPTY;
+
+        if (checkMove(state, &move) == MOVE_OK) {
+          return 1;
+        }
+      }
+    }
+  }
+
+  return 0;
+}
+
+// Position -> LegalSet table of a fixed size. Each bucket keeps the keys of
+// LEGAL_CACHE_WAYS positions in one cache line; the sets live in a parallel array.
+#define LEGAL_CACHE_WAYS 8
+
+typedef struct {
+  _Alignas(64) uint64_t keys[LEGAL_CACHE_WAYS];
+} LegalCacheBucket;
+
+typedef struct {
+  LegalCacheBucket *buckets;
+  LegalSet *sets;
+  uint64_t bucketMask;
+  uint64_t hits, misses, evictions, uncacheable;
+} LegalMoveCache;
+
+// larger requests are clamped, which also keeps the size computations below from overflowing
+#define LEGAL_CACHE_MAX_MEGABYTES (64 * 1024)
+
+// Uses at most megabytes of memory (up to LEGAL_CACHE_MAX_MEGABYTES), rounded down to a
+// power of two of buckets; there is always at least one bucket
+int legal_cache_init(LegalMoveCache *cache, size_t megabytes) {
+  size_t bucketBytes = sizeof(LegalCacheBucket) + LEGAL_CACHE_WAYS * sizeof(LegalSet);
+  uint64_t buckets = 1;
+  uint64_t limit = (uint64_t) (megabytes < LEGAL_CACHE_MAX_MEGABYTES ? megabytes : LEGAL_CACHE_MAX_MEGABYTES) << 20;
+
+  while (buckets * 2 * bucketBytes <= limit) {
+    buckets *= 2;
+  }
+
+  memset(cache, 0, sizeof(*cache));
+  cache->buckets = aligned_alloc(64, buckets * sizeof(LegalCacheBucket));
+  cache->sets = malloc(buckets * LEGAL_CACHE_WAYS * sizeof(LegalSet));
+  cache->bucketMask = buckets - 1;
+
+  if (!cache->buckets || !cache->sets) {
+    free(cache->buckets);
+    free(cache->sets);
+    return 0;
+  }
+
+  memset(cache->buckets, 0, buckets * sizeof(LegalCacheBucket));
+  return 1;
+}
+
+void legal_cache_free(LegalMoveCache *cache) {
+  free(cache->buckets);
+  free(cache->sets);
+}
+
+// Returns the legal moves of state, generating them on a miss; NULL if the
+// position can't be described by a LegalSet
+const LegalSet *legal_moves_cached(LegalMoveCache *cache, GameState *state) {
+  // key 0 marks an empty way
+  uint64_t key = state->key ? state->key : 1;
+  uint64_t bucket = key & cache->bucketMask;
+  uint64_t *keys = cache->buckets[bucket].keys;
+  int way;
+
+  for (way = 0; way < LEGAL_CACHE_WAYS; way++) {
+    if (keys[way] == key) {
+      cache->hits++;
+      return &cache->sets[bucket * LEGAL_CACHE_WAYS + way];
+    }
+  }
+
+  cache->misses++;
+
+  for (way = 0; way < LEGAL_CACHE_WAYS && keys[way]; way++) {
+  }
+  if (way == LEGAL_CACHE_WAYS) {
+    // the bucket is picked by the low bits, the victim by the high ones
+    way = key >> 61;
+    cache->evictions++;
+  }
+
+  LegalSet *set = &cache->sets[bucket * LEGAL_CACHE_WAYS + way];
+  if (!generate_legal_set(state, set)) {
+    keys[way] = 0;
+    cache->uncacheable++;
+    return NULL;
+  }
+
+  keys[way] = key;
+  return set;
+}
+
+#define CLEAR_SCREEN "\e[1;1H\e[2J"
+// the clear sequence, 8 rows of "X " pairs and a newline, and the blank line
+#define BOARD_TEXT_BYTES (sizeof(CLEAR_SCREEN) + 8 * 17 + 1)
+
+// Renders the board as text into out (BOARD_TEXT_BYTES at least); returns its length
+size_t render_board(GameState *state, char *out, int clear) {
+  char *p = out;
+
+  if (clear) {
+    memcpy(p, CLEAR_SCREEN, sizeof(CLEAR_SCREEN) - 1);
+    p += sizeof(CLEAR_SCREEN) - 1;
+  }
+
+  for (int i = 0; i < 8; i++) {
+    for (int j = 0; j < 8; j++) {
+      Piece piece = state->board[i][j];
+      char charToPrint = piece.type == EMPTY ? '.' : FEN_PIECES[piece.type];
+
+      *p++ = piece.color == BLACK ? tolower(charToPrint) : charToPrint;
+      *p++ = ' ';
+    }
+    *p++ = '\n';
+  }
+  *p++ = '\n';
+
+  return p - out;
+}
+
+// write() until everything is out
+int write_all(int fd, const char *data, size_t size) {
+  while (size) {
+    ssize_t written = write(fd, data, size);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return 0;
+    }
+    data += written;
+    size -= written;
+  }
+
+  return 1;
+}
+
+// Board last drawn on the terminal; while it is valid the next frame only rewrites
+// the squares that changed. Anything printed between frames besides the prompt that
+// follows one (messages, listings, questions) may scroll the board away and invalidates it.
+typedef struct {
+  Piece board[8][8];
+  int valid;
+} TerminalFrame;
+
+TerminalFrame lastFrame;
+
+// below the board and the blank line after it
+#define TEXT_ROW 10
+// a cursor move (\e[8;15H) and the piece for each square, then the move below the board
+#define BOARD_DIFF_BYTES (64 * 8 + 16)
+
+void invalidate_frame(void) {
+  lastFrame.valid = 0;
+}
+
+// Cursor addressed updates of the squares that differ from the last frame, then the
+// text under the board is cleared so prompts don't pile up
+size_t render_board_diff(GameState *state, char *out) {
+  char *p = out;
+
+  for (int i = 0; i < 8; i++) {
+    for (int j = 0; j < 8; j++) {
+      Piece piece = state->board[i][j], old = lastFrame.board[i][j];
+
+      if (piece.type == old.type && piece.color == old.color) {
+        continue;
+      }
+
+      char charToPrint = piece.type == EMPTY ? '.' : FEN_PIECES[piece.type];
+      p += sprintf(p, "\e[%d;%dH%c", i + 1, j * 2 + 1, piece.color == BLACK ? tolower(charToPrint) : charToPrint);
+    }
+  }
+
+  p += sprintf(p, "\e[%d;1H\e[J", TEXT_ROW);
+  return p - out;
+}
+
+// The frame goes out with a single write; stdout is flushed first to keep the order.
+// Redirected output always gets whole boards.
+void displayBoard(GameState *state) {
+  char frame[BOARD_DIFF_BYTES > BOARD_TEXT_BYTES ? BOARD_DIFF_BYTES : BOARD_TEXT_BYTES];
+  size_t len;
+
+  fflush(stdout);
+
+  if (lastFrame.valid && isatty(STDOUT_FILENO)) {
+    len = render_board_diff(state, frame);
+  } else {
+    len = render_board(state, frame, 1);
+  }
+
+  write_all(STDOUT_FILENO, frame, len);
+  memcpy(lastFrame.board, state->board, sizeof(lastFrame.board));
+  lastFrame.valid = 1;
+}
+
+// Shows the position after ply moves; n and p step through the record, x leaves
+#define REPLAY_CHECKPOINT_PLIES 16
+
+void replayGame(Move *moves, int gameLength, int ply) {
+  GameState state;
+  char fen[FEN_SIZE], input[20];
+  int shown = -1;
+  // checkpoints[c] is the position after c * REPLAY_CHECKPOINT_PLIES plies, taken the
+  // first time the replay passes it; without them stepping back replays from the start
+  int checkpointCount = gameLength / REPLAY_CHECKPOINT_PLIES + 1;
+  GameState **checkpoints = counted_calloc(checkpointCount, sizeof(GameState *));
+
+  while (1) {
+    if (ply != shown) {
+      if (ply < shown || shown < 0) {
+        int c = checkpoints ? ply / REPLAY_CHECKPOINT_PLIES : 0;
+        while (c > 0 && !checkpoints[c]) {
+          c--;
+        }
+        if (c > 0) {
+          state = *checkpoints[c];
+        } else {
+          initializeBoard(&state);
+        }
+        shown = c * REPLAY_CHECKPOINT_PLIES;
+      }
+      for (; shown < ply; shown++) {
+        makeMove(&state, &moves[shown]);
+
+        int c = (shown + 1) / REPLAY_CHECKPOINT_PLIES;
+        if (checkpoints && (shown + 1) % REPLAY_CHECKPOINT_PLIES == 0 && !checkpoints[c] &&
+            (checkpoints[c] = state_acquire())) {
+          *checkpoints[c] = state;
+        }
+      }
+
+      dumpFen(&state, fen, sizeof(fen));
+      displayBoard(&state);
+      printf("Move %d of %d\nFEN: %s\n\nn - next move, p - previous move, x - exit\n> ", ply, gameLength, fen);
+    }
+
+    if (scanf("%19s", input) != 1 || strcmp(input, "x") == 0) {
+      break;
+    }
+
+    if (strcmp(input, "n") == 0 && ply < gameLength) {
+      ply++;
+    } else if (strcmp(input, "p") == 0 && ply > 0) {
+      ply--;
+    } else if (strcmp(input, "n") == 0 || strcmp(input, "p") == 0) {
+      invalidate_frame();
+      printf("There's no such move\n> ");
+    } else {
+      invalidate_frame();
+      printf("Wrong input! Try again...\n> ");
+    }
+  }
+
+  if (checkpoints) {
+    state_release_bulk(checkpoints, checkpointCount);
+    counted_free(checkpoints);
+  }
+  printf("\n");
+}
+
+// Prints the legal targets of a square typed on its own (e.g. e2)
+void show_square_moves(GameState *state, LegalSet *legal, const char *square) {
+  int file = tolower(square[0]) - 'a', rank = '8' - square[1];
+  uint64_t targets = legal_set_targets(legal, rank * 8 + file);
+
+  invalidate_frame();
+
+  if (state->board[rank][file].color != (state->whiteToMove ? WHITE : BLACK)) {
+    printf("No %s piece at %c%c\n> ", state->whiteToMove ? "white" : "black", 'a' + file, '8' - rank);
+    return;
+  }
+
+  if (!targets) {
+    printf("No legal moves from %c%c\n> ", 'a' + file, '8' - rank);
+    return;
+  }
+
+  printf("Legal moves from %c%c:", 'a' + file, '8' - rank);
+  while (targets) {
+    int to = __builtin_ctzll(targets);
+    targets &= targets - 1;
+    printf(" %c%c", 'a' + to % 8, '8' - to / 8);
+  }
+  printf("\n> ");
+}
+
+void insert_moves(GameState *state, Move **moves, int *gameLength) {
+  char move[6], input_buffer[20];
+  LegalSet legal;
+  // refreshed once per ply; typed moves are checked against it with a bit test
+  int haveLegal = generate_legal_set(state, &legal);
+
+  printf("\nEnter move:\n> ");
+  while (scanf("%19s", input_buffer) == 1) {
+    if (strcmp(input_buffer, "x") == 0) {
+      break;
+    }
+
+    if (haveLegal && strlen(input_buffer) == 2 &&
+        tolower(input_buffer[0]) >= 'a' && tolower(input_buffer[0]) <= 'h' &&
+        input_buffer[1] >= '1' && input_buffer[1] <= '8') {
+      show_square_moves(state, &legal, input_buffer);
+      continue;
+    }
+
+    for (int i = 0; i < 5; i++) {
+      move[i] = input_buffer[i];
+    }
+    move[5] = '\0';
+	
+    if (strlen(input_buffer) <= 5 && parseMove(move)) {
+      if (!modify_memory(moves, *gameLength, 1))
+        return;
+      Move *next = &(*moves)[*gameLength];
+      load_move(move, next);
+
+      int from = next->fromRank * 8 + next->fromFile, to = next->toRank * 8 + next->toFile;
+      Piece piece = state->board[next->fromRank][next->fromFile];
+      int own = piece.color == (state->whiteToMove ? WHITE : BLACK);
+      int played = 0;
+
+      // a promotion letter only fits a pawn reaching the last rank
+      if (move[4] && (next->promotion == EMPTY || piece.type != PAWN || (next->toRank != 0 && next->toRank != 7))) {
+        invalidate_frame();
+        printf("Invalid move: %s (only a pawn reaching the last rank promotes)\n> ", input_buffer);
+      } else if (haveLegal && legal_set_has(&legal, from, to)) {
+        moveInBoard(state, next, &piece);
+        played = 1;
+      } else if (haveLegal && own && !legal_set_targets(&legal, from)) {
+        invalidate_frame();
+        printf("Invalid move (no legal moves from %c%d)\n> ", 'a' + next->fromFile, 8 - next->fromRank);
+      } else {
+        // not legal (or no set for this position): makeMove explains why
+        played = makeMove(state, next);
+      }
+
+      if (played) {
+        *gameLength += 1;
+        haveLegal = generate_legal_set(state, &legal);
+        displayBoard(state);
+        printf("\nEnter move:\n> ");
+      }
+    } else {
+      invalidate_frame();
+      printf("Invalid move: %s (wrong input)\n> ", input_buffer);
+    }
+    fflush(stdin);
+  }
+}
+
+void insertGame(Move **moves, int *gameLength) {
+  GameState state;
+  initializeBoard(&state);
+  displayBoard(&state);
+  *gameLength = 0;
+  reset_session(moves);
+
+  insert_moves(&state, moves, gameLength);
+}
+
+void continue_editing(Move **moves, int *gameLength) {
+  GameState state;
+  initializeBoard(&state);
+
+  for (int i = 0; i < *gameLength; i++) {
+    makeMove(&state, &(*moves)[i]);
+  }
+
+  displayBoard(&state);
+
+  insert_moves(&state, moves, gameLength);
+}
+
+void unparse_move(Move *move, char *moveStr) {
+  moveStr[0] = move->fromFile + 'a';
+  moveStr[1] = 8 + ('0' - move->fromRank);
+  moveStr[2] = move->toFile + 'a';
+  moveStr[3] = 8 + ('0' - move->toRank);
+  moveStr[4] = promotionToChar(move->promotion);
+  moveStr[5] = '\0';
+}
+
+void view_record(Move *moves, int *gameLength) {
+  char moveStr[6];
+
+  printf("\n");
+  for (int i = 0; i < *gameLength; i++) {
+    unparse_move(&moves[i], moveStr);
+    printf(" %d. %s\n", i + 1, moveStr);
+  }
+  printf("\n");
+}
+
+void insert_in_record(Move **origMoves, int *gameLength) {
+  int num_buf, exit_flag = 0;
+  char move_str[6], move_buf[20];
+
+  Move *moves = NULL;
+  int oldGamelength = *gameLength;
+
+  if(!modify_memory(&moves, oldGamelength, 0))
+    return;
+
+  for (int i = 0; i < *gameLength; i++) {
+    // printf("%d", moves[i].fromRank);
+    // printf("%d", (*origMoves)[i].fromRank);
+    moves[i] = (*origMoves)[i];
+  }
+
+  while (!exit_flag) {
+    printf("\nEnter the move you want to insert after:\n> ");
+
+    while (scanf("%i", &num_buf) != 1) {
+      printf("Wrong input! Try again...\n> ");
+      fflush(stdin);
+    }
+
+    if (num_buf > *gameLength || num_buf < 0) {
+      printf("Wrong input! Try again...\n");
+      continue; 
+    }
+
+    while (1) {
+      printf("Enter a move you want to add, x when finished or z to discard changes:\n> ");
+
+      while (scanf("%s", move_buf) != 1) {
+        printf("Wrong input! Try again...\n> ");
+        fflush(stdin);
+      }
+
+      if (move_buf[0] == 'x') {
+        GameState state;
+        initializeBoard(&state);
+        for (int i = 0; i < *gameLength; i++) {
+          if (!makeMove(&state, &moves[i])) {
+            printf("Unable to save changes since the record has mistakes!\n");
+            continue;
+          }
+        }
+
+		    free_memory(origMoves);
+		    *origMoves = moves;
+				
+        printf("Game was saved successfully!\n");
+
+        exit_flag = 1;
+        break;
+      }
+
+      if (move_buf[0] == 'z') {
+        printf("Discarding changes!\n");
+        *gameLength = oldGamelength;
+		
+		    free_memory(&moves);
+        exit_flag = 1;
+        break;
+      }
+
+      for (int i = 0; i < 5; i++) {
+        move_str[i] = move_buf[i];
+      }
+      move_str[5] = '\0';
+
+      Move move;
+      if (parseMove(move_str)) {
+      	load_move(move_str, &move);
+      	
+      	*gameLength += 1;
+      	if(!modify_memory(&moves, *gameLength, 1))
+          return;
+
+        for (int i = *gameLength - 1; i >= num_buf; i--) {
+          moves[i + 1] = moves[i];
+        }
+
+        moves[num_buf] = move;
+
+        num_buf++;
+      } else {
+        printf("Wrong input! Try again...\n");
+        fflush(stdin);
+      }
+    }
+  }
+}
+
+void remove_from_record(Move **origMoves, int *gameLength) {
+  int num_buf, exit_flag = 0;
+  char option_buf[20];
+
+  Move *moves = NULL;
+  int oldGamelength = *gameLength;
+
+  if (!modify_memory(&moves, oldGamelength, 0))
+    return;
+
+  for (int i = 0; i < *gameLength; i++) {
+    moves[i] = (*origMoves)[i];
+  }
+  
+  while (!exit_flag) {
+    printf("\nEnter the move you want to remove or 0 to finish:\n> ");
+
+    while (scanf("%i", &num_buf) != 1) {
+      printf("Wrong input! Try again...\n> ");
+      fflush(stdin);
+    }
+
+    if (num_buf == 0) {
+      free_memory(origMoves);
+      *origMoves = moves;
+	  
+      return;
+    }
+
+    if (num_buf > *gameLength || num_buf <= 0) {
+      printf("Wrong input! Try again...\n");
+      continue; 
+    }
+	
+    for (int i = num_buf - 1; i < *gameLength - 1; i++) {
+      moves[i] = moves[i + 1];
+    }
+    
+    if (!modify_memory(&moves, *gameLength, -1))
+      return;
+
+    *gameLength -= 1;
+
+    while (1) {
+      view_record(moves, gameLength);
+      printf("\nEnter c to continue removing, x to finish removing, v to insert new moves or z to discard changes:\n> ");
+
+      while (scanf("%s", option_buf) != 1) {
+        printf("Wrong input! Try again...\n> ");
+        fflush(stdin);
+      }
+
+      if (option_buf[0] == 'c') {
+        break;
+      }
+
+      if (option_buf[0] == 'x') {
+        GameState state;
+        initializeBoard(&state);
+        for (int i = 0; i < *gameLength; i++) {
+          if (!makeMove(&state, &moves[i])) {
+            printf("Unable to save changes since the record has illegal moves!\n");
+            *gameLength = oldGamelength;
+            free_memory(&moves);
+            return;
+          }
+        }
+
+        free_memory(origMoves);
+      	*origMoves = moves;
+
+        printf("Game was saved successfully!\n");
+
+        exit_flag = 1;
+        break;
+      }
+
+      if (option_buf[0] == 'z') {
+        printf("Discarding changes\n");
+        *gameLength = oldGamelength;
+
+        free_memory(&moves);
+        exit_flag = 1;
+        return;
+      }
+
+      if (option_buf[0] == 'v') {
+        insert_in_record(&moves, gameLength);
+        break;
+      }
+    }
+  }
+}
+
+void read_filename(char *filename) {
+  while (1) {
+    printf("Enter filename of the file with game:\n> ");
+    if (scanf("%49s", filename) != 1) {
+      printf("Wrong input! Try again\n> ");
+      continue;
+    }
+    break;
+  }
+}
+
+int has_extension(const char *filename, const char *ext) {
+  size_t len = strlen(filename), extLen = strlen(ext);
+  return len >= extLen && strcmp(filename + len - extLen, ext) == 0;
+}
+
+uint32_t CRC_TABLE[256];
+pthread_once_t crcTableOnce = PTHREAD_ONCE_INIT;
+
+void init_crc_table(void) {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) {
+      c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+    }
+    CRC_TABLE[i] = c;
+  }
+}
+
+// Continues crc (0 to start) over more data, so a CRC can be built piece by piece
+uint32_t crc32_update(uint32_t crc, const void *data, size_t size) {
+  const unsigned char *bytes = data;
+
+  pthread_once(&crcTableOnce, init_crc_table);
+
+  crc ^= 0xffffffff;
+  for (size_t i = 0; i < size; i++) {
+    crc = CRC_TABLE[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+  }
+
+  return crc ^ 0xffffffff;
+}
+
+uint32_t crc32(const void *data, size_t size) {
+  return crc32_update(0, data, size);
+}
+
+PackedMove pack_move(Move *move) {
+  return (PackedMove) ((move->fromRank * 8 + move->fromFile) |
+                       (move->toRank * 8 + move->toFile) << 6 |
+                       (move->promotion & 7) << 12);
+}
+
+void unpack_move(PackedMove packed, Move *move) {
+  move->fromRank = (packed >> 3) & 7;
+  move->fromFile = packed & 7;
+  move->toRank = (packed >> 9) & 7;
+  move->toFile = (packed >> 6) & 7;
+  move->promotion = (packed >> 12) & 7;
+}
+
+// Replays the record from the initial position without printing anything
+int validate_record(Move *moves, int gameLength) {
+  GameState state;
+  initializeBoard(&state);
+
+  for (int i = 0; i < gameLength; i++) {
+    if (playMove(&state, &moves[i]) != MOVE_OK) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+int save_text_game(FILE *fp, Move *moves, int gameLength) {
+  char move[6];
+
+  for (int i = 0; i < gameLength; i++) {
+    unparse_move(&moves[i], move);
+    if (fprintf(fp, "%s\n", move) < 0) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+int save_binary_game(FILE *fp, Move *moves, int gameLength) {
+  GameFileHeader header;
+  PackedMove *packed = counted_malloc(gameLength * sizeof(PackedMove) + 1);
+
+  if (!packed) {
+    return 0;
+  }
+
+  for (int i = 0; i < gameLength; i++) {
+    packed[i] = pack_move(&moves[i]);
+  }
+
+  header.magic = GAME_FILE_MAGIC;
+  header.version = GAME_FILE_VERSION;
+  header.flags = validate_record(moves, gameLength) ? GAME_FLAG_VALIDATED : 0;
+  header.plyCount = gameLength;
+  header.crc = crc32(packed, gameLength * sizeof(PackedMove));
+
+  int ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+           fwrite(packed, sizeof(PackedMove), gameLength, fp) == (size_t) gameLength;
+
+  counted_free(packed);
+  return ok;
+}
+
+int archive_write_tail(Archive *ar) {
+  ArchiveFooter footer;
+
+  footer.indexOffset = ar->indexOffset;
+  footer.gameCount = ar->gameCount;
+  footer.crc = crc32(ar->index, ar->gameCount * sizeof(ArchiveEntry));
+  footer.magic = ARCHIVE_MAGIC;
+  ar->atEnd = 0;
+
+  int ok = fseek(ar->fp, ar->indexOffset, SEEK_SET) == 0 &&
+           (!ar->gameCount || fwrite(ar->index, sizeof(ArchiveEntry), ar->gameCount, ar->fp) == ar->gameCount) &&
+           fwrite(&footer, sizeof(footer), 1, ar->fp) == 1 &&
+           fflush(ar->fp) == 0;
+
+  // an older archive is upgraded only after the index without its stale flags is out
+  if (ok && ar->version != ARCHIVE_VERSION) {
+    ArchiveHeader header;
+    header.magic = ARCHIVE_MAGIC;
+    header.version = ARCHIVE_VERSION;
+    header.reserved = 0;
+    ok = fseek(ar->fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, ar->fp) == 1 &&
+         fflush(ar->fp) == 0;
+    ar->version = ok ? ARCHIVE_VERSION : ar->version;
+  }
+
+  return ok;
+}
+
+// Opens an archive for reading, or for appending (created if it doesn't exist).
+// Only the footer is read unless appending, so opening doesn't depend on the archive size.
+Archive *archive_open(const char *filename, int writable) {
+  ArchiveHeader header;
+  ArchiveFooter footer;
+  Archive *ar = counted_calloc(1, sizeof(Archive));
+
+  if (!ar) {
+    return NULL;
+  }
+
+  ar->writable = writable;
+  ar->fp = fopen(filename, writable ? "r+b" : "rb");
+
+  if (!ar->fp && writable) {
+    ar->fp = fopen(filename, "w+b");
+    header.magic = ARCHIVE_MAGIC;
+    header.version = ARCHIVE_VERSION;
+    header.reserved = 0;
+    ar->indexOffset = sizeof(header);
+    ar->version = ARCHIVE_VERSION;
+    if (ar->fp && fwrite(&header, sizeof(header), 1, ar->fp) == 1 && archive_write_tail(ar)) {
+      return ar;
+    }
+  }
+
+  if (!ar->fp) {
+    counted_free(ar);
+    return NULL;
+  }
+
+  long footerOffset = -1;
+
+  // the index has to fit between the header and the footer, or seeking and allocating
+  // for it would trust whatever a damaged footer says
+  if (fread(&header, sizeof(header), 1, ar->fp) != 1 ||
+      header.magic != ARCHIVE_MAGIC || header.version < ARCHIVE_OLDEST_VERSION || header.version > ARCHIVE_VERSION ||
+      fseek(ar->fp, -(long) sizeof(footer), SEEK_END) || (footerOffset = ftell(ar->fp)) < (long) sizeof(header) ||
+      fread(&footer, sizeof(footer), 1, ar->fp) != 1 || footer.magic != ARCHIVE_MAGIC ||
+      footer.indexOffset < sizeof(header) || footer.indexOffset > (uint64_t) footerOffset ||
+      footer.gameCount > ((uint64_t) footerOffset - footer.indexOffset) / sizeof(ArchiveEntry)) {
+    fclose(ar->fp);
+    counted_free(ar);
+    return NULL;
+  }
+
+  ar->gameCount = footer.gameCount;
+  ar->indexOffset = footer.indexOffset;
+  ar->version = header.version;
+
+  if (writable) {
+    ar->indexCapacity = ar->gameCount;
+    ar->index = counted_malloc(ar->gameCount * sizeof(ArchiveEntry) + 1);
+    if (!ar->index || fseek(ar->fp, ar->indexOffset, SEEK_SET) ||
+        fread(ar->index, sizeof(ArchiveEntry), ar->gameCount, ar->fp) != ar->gameCount ||
+        crc32(ar->index, ar->gameCount * sizeof(ArchiveEntry)) != footer.crc) {
+      fclose(ar->fp);
+      counted_free(ar->index);
+      counted_free(ar);
+      return NULL;
+    }
+    // the flags of an older archive don't hold under the current rules
+    if (ar->version != ARCHIVE_VERSION) {
+      for (uint64_t i = 0; i < ar->gameCount; i++) {
+        ar->index[i].flags &= ~GAME_FLAG_VALIDATED;
+      }
+      ar->dirty = 1;
+    }
+  }
+
+  return ar;
+}
+
+// Writes the index back if games were appended; returns 0 if that failed
+int archive_close(Archive *ar) {
+  int ok = !ar->dirty || archive_write_tail(ar);
+
+  fclose(ar->fp);
+  counted_free(ar->index);
+  counted_free(ar);
+
+  return ok;
+}
+
+int archive_entry(Archive *ar, uint64_t k, ArchiveEntry *entry) {
+  if (k >= ar->gameCount) {
+    return 0;
+  }
+
+  if (ar->index) {
+    *entry = ar->index[k];
+    return 1;
+  }
+
+  return fseek(ar->fp, ar->indexOffset + k * sizeof(ArchiveEntry), SEEK_SET) == 0 &&
+         fread(entry, sizeof(ArchiveEntry), 1, ar->fp) == 1;
+}
+
+// Reads game k (0-based) with one index lookup; returns the number of moves, -1 on error
+int archive_read_game(Archive *ar, uint64_t k, Move **moves, int *validated) {
+  ArchiveEntry entry;
+
+  // a damaged index must not size the allocation: the moves have to lie in the game
+  // data (which archive_open checked against the file) and fit the int returned
+  if (!archive_entry(ar, k, &entry) || entry.plyCount > INT_MAX ||
+      entry.offset < sizeof(ArchiveHeader) || entry.offset > ar->indexOffset ||
+      (uint64_t) entry.plyCount * sizeof(PackedMove) > ar->indexOffset - entry.offset) {
+    return -1;
+  }
+
+  PackedMove *packed = counted_malloc(entry.plyCount * sizeof(PackedMove) + 1);
+  if (!packed) {
+    return -1;
+  }
+
+  ar->atEnd = 0;
+  if (fseek(ar->fp, entry.offset, SEEK_SET) ||
+      fread(packed, sizeof(PackedMove), entry.plyCount, ar->fp) != entry.plyCount ||
+      crc32(packed, entry.plyCount * sizeof(PackedMove)) != entry.crc ||
+      !modify_memory(moves, 0, entry.plyCount)) {
+    counted_free(packed);
+    return -1;
+  }
+
+  for (uint32_t i = 0; i < entry.plyCount; i++) {
+    unpack_move(packed[i], &(*moves)[i]);
+  }
+
+  *validated = ar->version == ARCHIVE_VERSION && (entry.flags & GAME_FLAG_VALIDATED);
+
+  counted_free(packed);
+  return entry.plyCount;
+}
+
+// Adds a game after the existing ones; the index is written by archive_close
+int archive_append_packed(Archive *ar, const PackedMove *packed, uint32_t plyCount, int validated) {
+  ArchiveEntry entry;
+
+  if (!ar->writable) {
+    return 0;
+  }
+
+  if (ar->gameCount == ar->indexCapacity) {
+    uint64_t capacity = ar->indexCapacity ? ar->indexCapacity * 2 : 64;
+    ArchiveEntry *index = counted_realloc(ar->index, capacity * sizeof(ArchiveEntry));
+    if (!index) {
+      return 0;
+    }
+    ar->index = index;
+    ar->indexCapacity = capacity;
+  }
+
+  memset(&entry, 0, sizeof(entry));
+  entry.gameId = ar->gameCount ? ar->index[ar->gameCount - 1].gameId + 1 : 1;
+  entry.offset = ar->indexOffset;
+  entry.plyCount = plyCount;
+  entry.crc = crc32(packed, plyCount * sizeof(PackedMove));
+  entry.flags = validated ? GAME_FLAG_VALIDATED : 0;
+
+  // consecutive appends continue where the last one stopped, without flushing on a seek;
+  // after a read or a failed write the position has to be set again
+  if (!ar->atEnd && fseek(ar->fp, ar->indexOffset, SEEK_SET)) {
+    return 0;
+  }
+  ar->dirty = 1;
+
+  ar->atEnd = fwrite(packed, sizeof(PackedMove), plyCount, ar->fp) == plyCount;
+  if (!ar->atEnd) {
+    return 0;
+  }
+
+  ar->index[ar->gameCount++] = entry;
+  ar->indexOffset += plyCount * sizeof(PackedMove);
+
+  return 1;
+}
+
+int archive_append_game(Archive *ar, Move *moves, int gameLength, int validated) {
+  PackedMove *packed = counted_malloc(gameLength * sizeof(PackedMove) + 1);
+
+  if (!packed) {
+    return 0;
+  }
+
+  for (int i = 0; i < gameLength; i++) {
+    packed[i] = pack_move(&moves[i]);
+  }
+
+  int ok = archive_append_packed(ar, packed, gameLength, validated);
+
+  counted_free(packed);
+  return ok;
+}
+
+int save_archive_game(const char *filename, Move *moves, int gameLength) {
+  Archive *ar = archive_open(filename, 1);
+
+  if (!ar) {
+    return 0;
+  }
+
+  int ok = archive_append_game(ar, moves, gameLength, validate_record(moves, gameLength));
+
+  return archive_close(ar) && ok;
+}
+
+int load_archive_game(const char *filename, Move **moves, int *validated) {
+  uint64_t k;
+  Archive *ar = archive_open(filename, 0);
+
+  if (!ar) {
+    return -1;
+  }
+
+  if (!ar->gameCount) {
+    archive_close(ar);
+    return -1;
+  }
+
+  printf("The archive has %llu games, enter the number of the game to load:\n> ", (unsigned long long) ar->gameCount);
+  while (scanf("%llu", (unsigned long long *) &k) != 1 || k < 1 || k > ar->gameCount) {
+    printf("Wrong input! Try again...\n> ");
+    fflush(stdin);
+  }
+
+  int game_length = archive_read_game(ar, k - 1, moves, validated);
+
+  archive_close(ar);
+  return game_length;
+}
+
+// Read-only view of an archive: moves are decoded straight from the mapped pages
+typedef struct {
+  const unsigned char *base;
+  size_t size;
+  const unsigned char *index;
+  uint64_t gameCount;
+} MappedArchive;
+
+int archive_map(const char *filename, MappedArchive *ar) {
+  struct stat st;
+  ArchiveHeader header;
+  ArchiveFooter footer;
+  int fd = open(filename, O_RDONLY);
+
+  if (fd < 0) {
+    return 0;
+  }
+
+  if (fstat(fd, &st) || st.st_size < (off_t) (sizeof(header) + sizeof(footer))) {
+    close(fd);
+    return 0;
+  }
+
+  ar->size = st.st_size;
+  ar->base = mmap(NULL, ar->size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (ar->base == MAP_FAILED) {
+    return 0;
+  }
+
+  memcpy(&header, ar->base, sizeof(header));
+  memcpy(&footer, ar->base + ar->size - sizeof(footer), sizeof(footer));
+
+  if (header.magic != ARCHIVE_MAGIC || header.version < ARCHIVE_OLDEST_VERSION || header.version > ARCHIVE_VERSION ||
+      footer.magic != ARCHIVE_MAGIC ||
+      footer.indexOffset > ar->size - sizeof(footer) ||
+      footer.gameCount > (ar->size - sizeof(footer) - footer.indexOffset) / sizeof(ArchiveEntry)) {
+    munmap((void *) ar->base, ar->size);
+    return 0;
+  }
+
+  ar->index = ar->base + footer.indexOffset;
+  ar->gameCount = footer.gameCount;
+
+  return 1;
+}
+
+void archive_unmap(MappedArchive *ar) {
+  munmap((void *) ar->base, ar->size);
+  ar->base = NULL;
+}
+
+// Points at the packed moves of game k inside the mapping, NULL if the entry is out of
+// range or its moves don't lie between the header and the index
+const PackedMove *mapped_game(MappedArchive *ar, uint64_t k, ArchiveEntry *entry) {
+  size_t dataEnd = ar->index - ar->base;
+
+  if (k >= ar->gameCount) {
+    return NULL;
+  }
+
+  // index entries aren't necessarily aligned in the file
+  memcpy(entry, ar->index + k * sizeof(ArchiveEntry), sizeof(ArchiveEntry));
+
+  // compared by subtraction, a huge offset must not wrap around
+  if (entry->offset < sizeof(ArchiveHeader) || entry->offset > dataEnd ||
+      (uint64_t) entry->plyCount * sizeof(PackedMove) > dataEnd - entry->offset) {
+    return NULL;
+  }
+
+  return (const PackedMove *) (ar->base + entry->offset);
+}
+
+// Plays packed moves on state; returns how many plies were legal before the first illegal
+// one, whose reason goes to *status if status isn't NULL
+uint32_t replay_packed(GameState *state, const PackedMove *packed, uint32_t plyCount, MoveStatus *status) {
+  MoveStatus result = MOVE_OK;
+  Move move;
+  uint32_t i;
+
+  for (i = 0; i < plyCount; i++) {
+    unpack_move(packed[i], &move);
+    if ((result = playMove(state, &move)) != MOVE_OK) {
+      break;
+    }
+  }
+
+  if (status) {
+    *status = result;
+  }
+  return i;
+}
+
+// Plays packed moves checking each against the cached legal moves of the position;
+// checkMove runs only for moves that aren't legal, to find the reason
+uint32_t replay_with_legal_cache(LegalMoveCache *cache, GameState *state, const PackedMove *packed,
+                                 uint32_t plyCount, MoveStatus *status) {
+  Move move;
+
+  *status = MOVE_OK;
+
+  for (uint32_t i = 0; i < plyCount; i++) {
+    unpack_move(packed[i], &move);
+
+    const LegalSet *set = legal_moves_cached(cache, state);
+    int from = move.fromRank * 8 + move.fromFile, to = move.toRank * 8 + move.toFile;
+
+    if (set && !legal_set_has(set, from, to)) {
+      *status = checkMove(state, &move);
+      return i;
+    }
+
+    if (!set && (*status = checkMove(state, &move)) != MOVE_OK) {
+      return i;
+    }
+
+    Piece piece = state->board[move.fromRank][move.fromFile];
+    moveInBoard(state, &move, &piece);
+  }
+
+  return plyCount;
+}
+
+#define PGN_EXT ".pgn"
+#define PGN_LINE_WIDTH 79
+// a move number, a SAN move with a file, rank, capture, promotion and suffix, and the wrap
+#define PGN_PLY_BYTES 24
+#define PGN_TAG_BYTES 384
+// the comment after a record cut at an illegal move
+#define PGN_NOTE_BYTES 96
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+// Output collected in memory and written with one fwrite per OUTPUT_BUFFER_SIZE
+typedef struct {
+  FILE *fp;
+  char *data;
+  size_t used;
+  size_t capacity;
+  int failed;
+} OutputBuffer;
+
+int output_init(OutputBuffer *out, FILE *fp) {
+  out->fp = fp;
+  out->used = 0;
+  out->capacity = OUTPUT_BUFFER_SIZE;
+  out->failed = 0;
+  out->data = counted_malloc(out->capacity);
+  return out->data != NULL;
+}
+
+int output_flush(OutputBuffer *out) {
+  if (out->used && fwrite(out->data, 1, out->used, out->fp) != out->used) {
+    out->failed = 1;
+  }
+  out->used = 0;
+  return !out->failed;
+}
+
+// Makes room for size more bytes, flushing first and growing only for a record bigger than the buffer
+char *output_reserve(OutputBuffer *out, size_t size) {
+  if (out->capacity - out->used < size && !output_flush(out)) {
+    return NULL;
+  }
+
+  if (size > out->capacity) {
+    char *data = counted_realloc(out->data, size);
+    if (!data) {
+      out->failed = 1;
+      return NULL;
+    }
+    out->data = data;
+    out->capacity = size;
+  }
+
+  return out->data + out->used;
+}
+
+int output_free(OutputBuffer *out) {
+  int ok = output_flush(out);
+  counted_free(out->data);
+  return ok;
+}
+
+// Writes the SAN of a legal move (without the check suffix) before it is played;
+// the file and/or rank is added when another piece of the type can reach the square.
+// Pawns only get their file, and only on captures, as standard SAN has it.
+int format_san(GameState *state, Move *move, char *san) {
+  Piece piece = state->board[move->fromRank][move->fromFile];
+  int capture = state->board[move->toRank][move->toFile].type != EMPTY;
+  int rivals = 0, sameFile = 0, sameRank = 0, len = 0;
+  Move rival = *move;
+
+  for (int rank = 0; rank < 8; rank++) {
+    for (int file = 0; file < 8; file++) {
+      if ((rank == move->fromRank && file == move->fromFile) || state->board[rank][file].type != piece.type ||
+          state->board[rank][file].color != piece.color) {
+        continue;
+      }
+      rival.fromRank = rank;
+      rival.fromFile = file;
+      if (checkMove(state, &rival) == MOVE_OK) {
+        rivals++;
+        sameFile += file == move->fromFile;
+        sameRank += rank == move->fromRank;
+      }
+    }
+  }
+
+  if (piece.type != PAWN) {
+    san[len++] = " PRNBQK"[piece.type];
+  }
+  if (piece.type == PAWN ? capture : rivals && (!sameFile || sameRank)) {
+    san[len++] = 'a' + move->fromFile;
+  }
+  if (piece.type != PAWN && rivals && sameFile) {
+    san[len++] = '8' - move->fromRank;
+  }
+
+  if (capture) {
+    san[len++] = 'x';
+  }
+  san[len++] = 'a' + move->toFile;
+  san[len++] = '8' - move->toRank;
+
+  if (piece.type == PAWN && (move->toRank == 0 || move->toRank == 7)) {
+    san[len++] = '=';
+    san[len++] = toupper(promotionToChar(move->promotion ? move->promotion : QUEEN));
+  }
+
+  san[len] = '\0';
+  return len;
+}
+
+// Appends a game as PGN with the seven tag roster and the start position as a FEN tag,
+// which tells other readers that there is no castling; moves are played to get their
+// SAN and stop at the first illegal one, which a comment points out so the cut record
+// isn't taken for a whole game. Returns the number of plies written, -1 if the output
+// failed.
+long write_pgn_game(OutputBuffer *out, const PackedMove *packed, uint32_t plyCount, uint64_t number) {
+  GameState state;
+  Move move;
+  const char *result = "*";
+  char fen[FEN_SIZE], startTags[PGN_TAG_BYTES / 2];
+  int column = 0;
+  uint32_t i;
+
+  initializeBoard(&state);
+  dumpFen(&state, fen, sizeof(fen));
+  int startLen = snprintf(startTags, sizeof(startTags), "[SetUp \"1\"]\n[FEN \"%s\"]\n", fen);
+
+  char *text = output_reserve(out, PGN_TAG_BYTES + PGN_NOTE_BYTES + (size_t) plyCount * PGN_PLY_BYTES);
+  if (!text) {
+    return -1;
+  }
+
+  char *p = text + sprintf(text, "[Event \"lw10 game\"]\n[Site \"?\"]\n[Date \"????.??.??\"]\n"
+                                 "[Round \"%llu\"]\n[White \"?\"]\n[Black \"?\"]\n",
+                           (unsigned long long) number);
+  // the result is known after the moves, which are written past room for the longest one
+  char *resultTag = p;
+  char *moves = p += sizeof("[Result \"1/2-1/2\"]\n\n") - 1 + startLen;
+
+  for (i = 0; i < plyCount; i++) {
+    char token[PGN_PLY_BYTES];
+    int len = 0;
+
+    unpack_move(packed[i], &move);
+    if (checkMove(&state, &move) != MOVE_OK) {
+      break;
+    }
+
+    if (state.whiteToMove) {
+      len = sprintf(token, "%d. ", state.fullmoveNumber);
+    }
+    len += format_san(&state, &move, token + len);
+
+    Piece piece = state.board[move.fromRank][move.fromFile];
+    moveInBoard(&state, &move, &piece);
+
+    // the game is over when there is no move left, which only matters for the last ply
+    int check = inCheck(&state), over = (check || i + 1 == plyCount) && !hasLegalMove(&state);
+    if (check) {
+      token[len++] = over ? '#' : '+';
+    }
+    if (over) {
+      result = !check ? "1/2-1/2" : state.whiteToMove ? "0-1" : "1-0";
+    }
+
+    if (column && column + 1 + len > PGN_LINE_WIDTH) {
+      *p++ = '\n';
+      column = 0;
+    } else if (column) {
+      *p++ = ' ';
+      column++;
+    }
+    memcpy(p, token, len);
+    p += len;
+    column += len;
+  }
+
+  if (i < plyCount) {
+    char note[PGN_NOTE_BYTES];
+    int len = snprintf(note, sizeof(note), "{ply %u of %u is illegal, the rest of the record is left out}",
+                       i + 1, plyCount);
+    if (column) {
+      *p++ = '\n';
+    }
+    memcpy(p, note, len);
+    p += len;
+    column = len;
+  }
+
+  if (column && column + 1 + strlen(result) > PGN_LINE_WIDTH) {
+    *p++ = '\n';
+  } else if (column) {
+    *p++ = ' ';
+  }
+  p += sprintf(p, "%s\n\n", result);
+
+  // close the gap left for the longest result
+  int tagLen = sprintf(resultTag, "[Result \"%s\"]\n", result);
+  memcpy(resultTag + tagLen, startTags, startLen);
+  tagLen += startLen;
+  resultTag[tagLen] = '\n';
+  memmove(resultTag + tagLen + 1, moves, p - moves);
+  p -= moves - (resultTag + tagLen + 1);
+
+  out->used += p - text;
+  return i;
+}
+
+// Exports a record as a one game PGN file
+int save_pgn_game(FILE *fp, Move *moves, int gameLength) {
+  OutputBuffer out;
+  PackedMove *packed = counted_malloc(gameLength * sizeof(PackedMove) + 1);
+
+  if (!packed || !output_init(&out, fp)) {
+    counted_free(packed);
+    return 0;
+  }
+
+  for (int i = 0; i < gameLength; i++) {
+    packed[i] = pack_move(&moves[i]);
+  }
+
+  long written = write_pgn_game(&out, packed, gameLength, 1);
+  int ok = output_free(&out) && written == gameLength;
+
+  counted_free(packed);
+  return ok;
+}
+
+void save_data(Move *moves, int *gameLength) {
+  char filename[50];
+
+  read_filename(filename);
+
+  if (has_extension(filename, ARCHIVE_EXT)) {
+    if (save_archive_game(filename, moves, *gameLength)) {
+      printf("\nThe game was added to the archive!\n\n");
+    } else {
+      printf("\nUnable to write the archive!\n\n");
+    }
+    return;
+  }
+
+  FILE *fp;
+  fp = fopen(filename, "wb");
+
+  if (!fp) {
+    printf("\nThere's no such file!\n\n");
+    return;
+  }
+
+  // .lwg files get the binary format, .pgn files SAN, anything else is exported as text
+  int ok = has_extension(filename, GAME_FILE_EXT) ? save_binary_game(fp, moves, *gameLength) :
+           has_extension(filename, PGN_EXT) ? save_pgn_game(fp, moves, *gameLength)
+                                            : save_text_game(fp, moves, *gameLength);
+
+  if (ok) {
+    printf("\nThe game was saved succesfully!\n\n");
+  } else {
+    printf("\nUnable to write the file!\n\n");
+  }
+
+  fclose(fp);
+}
+
+// fscanf based reader the program used to load text games with, kept as the
+// reference for bench-load; returns the number of moves, -1 on a malformed move
+long read_text_moves_stdio(FILE *fp, Move *out, long capacity) {
+  long count = 0;
+  char move_buffer[20], move[6];
+
+  while (count < capacity && !feof(fp)) {
+    if (fscanf(fp, "%19s", move_buffer) == 1) {
+      for (int i = 0; i < 5; i++) {
+        move[i] = move_buffer[i];
+      }
+      move[5] = '\0';
+
+      if (!parseMove(move)) {
+        return -1;
+      }
+
+      load_move(move, &out[count]);
+      count++;
+    } else {
+      break;
+    }
+  }
+
+  return count;
+}
+
+// Coordinate move (e2e4, e7e8q) without going through a string copy
+int parse_coordinates(const char *token, size_t len, PackedMove *move) {
+  if (len < 4 ||
+      (unsigned) ((token[0] | 0x20) - 'a') > 7 || (unsigned) (token[1] - '1') > 7 ||
+      (unsigned) ((token[2] | 0x20) - 'a') > 7 || (unsigned) (token[3] - '1') > 7) {
+    return 0;
+  }
+
+  *move = (PackedMove) ((('8' - token[1]) * 8 + (token[0] | 0x20) - 'a') |
+                        (('8' - token[3]) * 8 + (token[2] | 0x20) - 'a') << 6 |
+                        (len > 4 ? promotionFromChar(token[4]) : EMPTY) << 12);
+
+  return 1;
+}
+
+// isspace in the C locale, without the locale table lookup
+int is_blank(char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Fixed width records ("e2e4\n") handled by one parse_move_batch call
+#define BATCH_MOVES 16
+#define BATCH_RECORD 5
+#define BATCH_BYTES (BATCH_MOVES * BATCH_RECORD)
+
+#ifdef __SSE2__
+// Per byte bounds for the 80 bytes of a batch: the record pattern repeats every 5 bytes,
+// so each of the 5 vectors gets its own lanes. Letters are compared after | 0x20.
+typedef struct {
+  __m128i caseBit[BATCH_RECORD], low[BATCH_RECORD], high[BATCH_RECORD];
+} BatchBounds;
+
+BatchBounds BATCH_BOUNDS;
+pthread_once_t batchBoundsOnce = PTHREAD_ONCE_INIT;
+
+void init_batch_bounds(void) {
+  BatchBounds *bounds = &BATCH_BOUNDS;
+  char caseBit[BATCH_BYTES], low[BATCH_BYTES], high[BATCH_BYTES];
+
+  for (int i = 0; i < BATCH_BYTES; i++) {
+    switch (i % BATCH_RECORD) {
+      case 0:
+      case 2:
+        caseBit[i] = 0x20;
+        low[i] = 'a';
+        high[i] = 'h';
+        break;
+      case 1:
+      case 3:
+        caseBit[i] = 0;
+        low[i] = '1';
+        high[i] = '8';
+        break;
+      default:
+        caseBit[i] = 0;
+        low[i] = '\n';
+        high[i] = '\n';
+        break;
+    }
+  }
+
+  for (int v = 0; v < BATCH_RECORD; v++) {
+    bounds->caseBit[v] = _mm_loadu_si128((const __m128i *) (caseBit + v * 16));
+    bounds->low[v] = _mm_loadu_si128((const __m128i *) (low + v * 16));
+    bounds->high[v] = _mm_loadu_si128((const __m128i *) (high + v * 16));
+  }
+}
+#endif
+
+// Validates BATCH_MOVES fixed width records at data and writes their packed moves;
+// returns 0 without writing anything if any record doesn't match, the caller then
+// parses those lines one by one.
+int parse_move_batch(const char *data, PackedMove *out) {
+  unsigned char bytes[BATCH_BYTES];
+
+#ifdef __SSE2__
+  BatchBounds *bounds = &BATCH_BOUNDS;
+  __m128i bad = _mm_setzero_si128();
+
+  pthread_once(&batchBoundsOnce, init_batch_bounds);
+
+  // bytes >= 0x80 are negative for the signed compares and fail the low bound
+  for (int v = 0; v < BATCH_RECORD; v++) {
+    __m128i chunk = _mm_or_si128(_mm_loadu_si128((const __m128i *) (data + v * 16)), bounds->caseBit[v]);
+    bad = _mm_or_si128(bad, _mm_cmplt_epi8(chunk, bounds->low[v]));
+    bad = _mm_or_si128(bad, _mm_cmpgt_epi8(chunk, bounds->high[v]));
+    _mm_storeu_si128((__m128i *) (bytes + v * 16), chunk);
+  }
+
+  if (_mm_movemask_epi8(bad)) {
+    return 0;
+  }
+#else
+  for (int i = 0; i < BATCH_BYTES; i += BATCH_RECORD) {
+    bytes[i] = data[i] | 0x20;
+    bytes[i + 1] = data[i + 1];
+    bytes[i + 2] = data[i + 2] | 0x20;
+    bytes[i + 3] = data[i + 3];
+    if ((unsigned) (bytes[i] - 'a') > 7 || (unsigned) (bytes[i + 1] - '1') > 7 ||
+        (unsigned) (bytes[i + 2] - 'a') > 7 || (unsigned) (bytes[i + 3] - '1') > 7 ||
+        data[i + 4] != '\n') {
+      return 0;
+    }
+  }
+#endif
+
+  for (int m = 0; m < BATCH_MOVES; m++) {
+    const unsigned char *record = bytes + m * BATCH_RECORD;
+    out[m] = (PackedMove) ((('8' - record[1]) * 8 + record[0] - 'a') |
+                           (('8' - record[3]) * 8 + record[2] - 'a') << 6);
+  }
+
+  return 1;
+}
+
+// Parses whitespace separated moves from data starting at *pos until out is full.
+// Runs of fixed width lines go through parse_move_batch, anything else is split
+// with memchr and parsed token by token. Returns the number of moves, -1 on a
+// malformed move (*pos is left at it).
+long parse_text_moves(const char *data, size_t size, size_t *pos, PackedMove *out, long capacity) {
+  size_t i = *pos;
+  long count = 0;
+  int scalarLines = 0;
+
+  while (count < capacity && i < size) {
+    if (scalarLines > 0) {
+      scalarLines--;
+    } else if (capacity - count >= BATCH_MOVES && size - i >= BATCH_BYTES) {
+      if (parse_move_batch(data + i, out + count)) {
+        count += BATCH_MOVES;
+        i += BATCH_BYTES;
+        continue;
+      }
+      // don't retry on every line of input that isn't fixed width
+      scalarLines = BATCH_MOVES;
+    }
+
+    const char *newline = memchr(data + i, '\n', size - i);
+    size_t lineEnd = newline ? (size_t) (newline - data) : size;
+
+    while (count < capacity && i < lineEnd) {
+      while (i < lineEnd && is_blank(data[i])) {
+        i++;
+      }
+
+      size_t tokenEnd = i;
+      while (tokenEnd < lineEnd && !is_blank(data[tokenEnd])) {
+        tokenEnd++;
+      }
+
+      if (tokenEnd == i) {
+        break;
+      }
+
+      if (!parse_coordinates(data + i, tokenEnd - i, &out[count])) {
+        *pos = i;
+        return -1;
+      }
+
+      count++;
+      i = tokenEnd;
+    }
+
+    if (i >= lineEnd) {
+      i = lineEnd + 1;
+    }
+  }
+
+  *pos = i < size ? i : size;
+  return count;
+}
+
+// Maps the file (falls back to one read) and hands it to fn; returns fn's result, -1 on I/O errors
+long with_file_contents(const char *filename, long (*fn)(const char *, size_t, void *), void *arg) {
+  struct stat st;
+  long result = -1;
+  int fd = open(filename, O_RDONLY);
+
+  if (fd < 0) {
+    return -1;
+  }
+
+  if (fstat(fd, &st)) {
+    close(fd);
+    return -1;
+  }
+
+  if (st.st_size == 0) {
+    close(fd);
+    return fn("", 0, arg);
+  }
+
+  char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  if (data != MAP_FAILED) {
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    result = fn(data, st.st_size, arg);
+    munmap(data, st.st_size);
+  } else if ((data = counted_malloc(st.st_size))) {
+    if (read(fd, data, st.st_size) == st.st_size) {
+      result = fn(data, st.st_size, arg);
+    }
+    counted_free(data);
+  }
+
+  close(fd);
+  return result;
+}
+
+// Upper bound of the moves in a text buffer: all but the last take at least 5 bytes ("e2e4\n")
+long text_moves_capacity(size_t size) {
+  return (size + 1) / 5 + 1;
+}
+
+long load_text_buffer(const char *data, size_t size, void *arg) {
+  Move **moves = arg;
+  size_t pos = 0;
+  PackedMove *packed = counted_malloc(text_moves_capacity(size) * sizeof(PackedMove));
+
+  if (!packed) {
+    return -1;
+  }
+
+  long count = parse_text_moves(data, size, &pos, packed, text_moves_capacity(size));
+
+  if (count < 0 || !modify_memory(moves, 0, count)) {
+    counted_free(packed);
+    return -1;
+  }
+
+  for (long i = 0; i < count; i++) {
+    unpack_move(packed[i], &(*moves)[i]);
+  }
+
+  counted_free(packed);
+  return count;
+}
+
+// Returns the number of moves read, -1 if the file is missing or has a malformed move
+int load_text_game(const char *filename, Move **moves) {
+  PROFILE_SCOPE(PROF_LOAD);
+  return with_file_contents(filename, load_text_buffer, moves);
+}
+
+// Resolves a SAN token (Nf3, exd5, R1a3, e8=Q+) against the legal moves of the position;
+// returns 0 if it matches no legal move or more than one. Castling (O-O) is never legal here.
+int resolve_san(GameState *state, const LegalSet *legal, const char *token, size_t len, Move *move) {
+  Type type = PAWN, promotion = EMPTY;
+  int fromFile = -1, fromRank = -1, found = 0;
+  size_t start = 0;
+
+  // check, mate and annotation suffixes
+  while (len && (token[len - 1] == '+' || token[len - 1] == '#' || token[len - 1] == '!' || token[len - 1] == '?')) {
+    len--;
+  }
+
+  if (len >= 3 && strchr("QRBN", token[len - 1]) && (token[len - 2] == '=' || isdigit(token[len - 2]))) {
+    promotion = promotionFromChar(token[len - 1]);
+    len -= token[len - 2] == '=' ? 2 : 1;
+  }
+
+  if (len && strchr("KQRBN", token[0])) {
+    type = token[0] == 'K' ? KING : token[0] == 'Q' ? QUEEN : token[0] == 'R' ? ROOK : token[0] == 'B' ? BISHOP : KNIGHT;
+    start = 1;
+  }
+
+  if (len < start + 2 || (unsigned) (token[len - 2] - 'a') > 7 || (unsigned) (token[len - 1] - '1') > 7) {
+    return 0;
+  }
+  int to = ('8' - token[len - 1]) * 8 + token[len - 2] - 'a';
+
+  // whatever is between the piece and the target square: a file, a rank and/or a capture
+  for (size_t i = start; i < len - 2; i++) {
+    if ((unsigned) (token[i] - 'a') <= 7) {
+      fromFile = token[i] - 'a';
+    } else if ((unsigned) (token[i] - '1') <= 7) {
+      fromRank = '8' - token[i];
+    } else if (token[i] != 'x' && token[i] != ':') {
+      return 0;
+    }
+  }
+
+  uint64_t from = legal->fromMask;
+  for (int entry = 0; from; entry++) {
+    int square = __builtin_ctzll(from);
+    from &= from - 1;
+
+    if (!(legal->targets[entry] >> to & 1) || state->board[square / 8][square % 8].type != type ||
+        (fromFile >= 0 && square % 8 != fromFile) || (fromRank >= 0 && square / 8 != fromRank)) {
+      continue;
+    }
+
+    if (found++) {
+      return 0;
+    }
+    move->fromRank = square / 8;
+    move->fromFile = square % 8;
+  }
+
+  if (found != 1 || (promotion != EMPTY && (type != PAWN || (to / 8 != 0 && to / 8 != 7)))) {
+    return 0;
+  }
+
+  move->toRank = to / 8;
+  move->toFile = to % 8;
+  // a promotion without the piece is taken as a queen, like in CLI mode
+  move->promotion = type == PAWN && (to / 8 == 0 || to / 8 == 7) && promotion == EMPTY ? QUEEN : promotion;
+
+  return 1;
+}
+
+// The token ends at a blank or at the start of a comment, variation or tag
+int is_pgn_delimiter(char c) {
+  return is_blank(c) || c == '{' || c == '}' || c == '(' || c == ')' || c == ';' || c == '[';
+}
+
+// Length of the game result starting at data, 0 if there's none
+size_t pgn_result_length(const char *data, size_t size) {
+  size_t len = size >= 7 && !memcmp(data, "1/2-1/2", 7) ? 7 :
+               size >= 3 && (!memcmp(data, "1-0", 3) || !memcmp(data, "0-1", 3)) ? 3 :
+               size >= 1 && data[0] == '*' ? 1 : 0;
+
+  return len && (len == size || is_pgn_delimiter(data[len])) ? len : 0;
+}
+
+// Skips the rest of a game: past its result, or to the next line starting with a tag
+void pgn_skip_game(const char *data, size_t size, size_t *pos) {
+  size_t i = *pos, len;
+
+  while (i < size && !(data[i] == '[' && (i == 0 || data[i - 1] == '\n'))) {
+    if ((i == 0 || is_pgn_delimiter(data[i - 1])) && (len = pgn_result_length(data + i, size - i))) {
+      i += len;
+      break;
+    }
+    i++;
+  }
+
+  *pos = i;
+}
+
+// Whether a FEN tag value (up to the closing quote) is the initial position; castling
+// rights and clocks don't matter, the records here always start from initializeBoard
+int pgn_initial_fen(const char *data, size_t size) {
+  GameState state, initial;
+  char fen[FEN_SIZE];
+  size_t len = 0;
+
+  while (len < size && len < sizeof(fen) - 1 && data[len] != '"') {
+    fen[len] = data[len];
+    len++;
+  }
+  fen[len] = '\0';
+
+  if (!loadFen(&state, fen)) {
+    return 0;
+  }
+
+  initializeBoard(&initial);
+  for (int i = 0; i < 8; i++) {
+    for (int j = 0; j < 8; j++) {
+      if (state.board[i][j].type != initial.board[i][j].type ||
+          state.board[i][j].color != initial.board[i][j].color) {
+        return 0;
+      }
+    }
+  }
+
+  return state.whiteToMove;
+}
+
+// Reads the game at *pos from a PGN buffer without copying it: tags, comments,
+// variations, NAGs and move numbers are skipped, SAN moves are resolved by playing
+// them from the initial position. Legal moves come from the cache if there is one.
+// Returns 1 with the moves in out, 0 when no game is left, -1 on a move that doesn't
+// resolve and -2 on castling or a [FEN] tag with another start, which this engine
+// doesn't play (*pos is left at the move).
+int pgn_next_game(const char *data, size_t size, size_t *pos, LegalMoveCache *cache,
+                  PackedMove *out, long capacity, long *plies) {
+  GameState state;
+  LegalSet generated;
+  Move move;
+  size_t i = *pos;
+  int seenMoves = 0, otherStart = 0;
+
+  initializeBoard(&state);
+  *plies = 0;
+
+  while (i < size) {
+    char c = data[i];
+
+    if (is_blank(c)) {
+      i++;
+    } else if (c == '[') {
+      // tags of the next game end this one if its result was missing
+      if (seenMoves) {
+        break;
+      }
+      if (size - i > 6 && !memcmp(data + i, "[FEN \"", 6) && !pgn_initial_fen(data + i + 6, size - i - 6)) {
+        otherStart = 1;
+      }
+      while (i < size && data[i] != '\n') {
+        i++;
+      }
+    } else if (c == '{') {
+      while (i < size && data[i] != '}') {
+        i++;
+      }
+      i++;
+    } else if (c == ';' || (c == '%' && (i == 0 || data[i - 1] == '\n'))) {
+      while (i < size && data[i] != '\n') {
+        i++;
+      }
+    } else if (c == '(') {
+      int depth = 0;
+      do {
+        depth += (data[i] == '(') - (data[i] == ')');
+        i++;
+      } while (i < size && depth);
+    } else {
+      size_t end = i;
+      while (end < size && !is_pgn_delimiter(data[end])) {
+        end++;
+      }
+
+      const char *token = data + i;
+      size_t len = end - i;
+
+      if (pgn_result_length(token, len) == len) {
+        seenMoves = 1;
+        i = end;
+        break;
+      }
+
+      // NAGs ($1) and stray closing characters
+      if (c == '$' || c == ')' || c == '}') {
+        i = end;
+        continue;
+      }
+
+      // O-O and O-O-O, also written with zeros; a game from a [FEN] position is given
+      // up at its first move, so that skipping it doesn't stop at its other tags
+      if ((len >= 3 && (!memcmp(token, "O-O", 3) || !memcmp(token, "0-0", 3))) || otherStart) {
+        *pos = i;
+        return -2;
+      }
+
+      // move numbers, which may be glued to the move (1.e4, 12...Nf6)
+      if (isdigit(c)) {
+        while (i < end && isdigit(data[i])) {
+          i++;
+        }
+        while (i < end && data[i] == '.') {
+          i++;
+        }
+        continue;
+      }
+
+      seenMoves = 1;
+
+      const LegalSet *legal = cache ? legal_moves_cached(cache, &state) : NULL;
+      if (!legal) {
+        generate_legal_set(&state, &generated);
+        legal = &generated;
+      }
+
+      int ply = trace_ply(&state);
+      uint64_t traceStart = trace_begin();
+      int resolved = *plies < capacity && resolve_san(&state, legal, token, len, &move);
+      trace_end("parse", traceStart, ply);
+
+      if (!resolved) {
+        *pos = i;
+        return -1;
+      }
+
+      traceStart = trace_begin();
+      Piece piece = state.board[move.fromRank][move.fromFile];
+      moveInBoard(&state, &move, &piece);
+      trace_end("update", traceStart, ply);
+      out[(*plies)++] = pack_move(&move);
+      i = end;
+    }
+  }
+
+  *pos = i < size ? i : size;
+  return seenMoves;
+}
+
+// Every move takes at least three bytes ("e4 ")
+long pgn_moves_capacity(size_t size) {
+  return size / 3 + 1;
+}
+
+long load_pgn_buffer(const char *data, size_t size, void *arg) {
+  Move **moves = arg;
+  size_t pos = 0;
+  long count;
+  int read;
+  PackedMove *packed = counted_malloc(pgn_moves_capacity(size) * sizeof(PackedMove));
+
+  if (!packed) {
+    return -1;
+  }
+
+  read = pgn_next_game(data, size, &pos, NULL, packed, pgn_moves_capacity(size), &count);
+  if (read <= 0 || !modify_memory(moves, 0, count)) {
+    counted_free(packed);
+    return read == -2 ? -2 : -1;
+  }
+
+  for (long i = 0; i < count; i++) {
+    unpack_move(packed[i], &(*moves)[i]);
+  }
+
+  counted_free(packed);
+  return count;
+}
+
+// Loads the first game of a PGN file; its moves are legal once they resolve.
+// Returns -2 if the game castles or starts from another position.
+int load_pgn_game(const char *filename, Move **moves) {
+  PROFILE_SCOPE(PROF_LOAD);
+  return with_file_contents(filename, load_pgn_buffer, moves);
+}
+
+// The whole file is read with one fread; returns the number of moves, -1 if the file is damaged
+int load_binary_game(FILE *fp, Move **moves, int *validated) {
+  PROFILE_SCOPE(PROF_LOAD);
+  GameFileHeader header;
+  long size;
+
+  if (fseek(fp, 0, SEEK_END) || (size = ftell(fp)) < (long) sizeof(header) || fseek(fp, 0, SEEK_SET)) {
+    return -1;
+  }
+
+  unsigned char *data = counted_malloc(size);
+  if (!data) {
+    return -1;
+  }
+
+  if (fread(data, 1, size, fp) != (size_t) size) {
+    counted_free(data);
+    return -1;
+  }
+
+  memcpy(&header, data, sizeof(header));
+  PackedMove *packed = (PackedMove *) (data + sizeof(header));
+
+  if (header.magic != GAME_FILE_MAGIC || header.version < GAME_FILE_OLDEST_VERSION ||
+      header.version > GAME_FILE_VERSION ||
+      // exactly the moves, a stray trailing byte means the file is damaged
+      (uint64_t) size - sizeof(header) != (uint64_t) header.plyCount * sizeof(PackedMove) ||
+      header.plyCount > INT_MAX ||
+      crc32(packed, header.plyCount * sizeof(PackedMove)) != header.crc ||
+      !modify_memory(moves, 0, header.plyCount)) {
+    counted_free(data);
+    return -1;
+  }
+
+  for (uint32_t i = 0; i < header.plyCount; i++) {
+    unpack_move(packed[i], &(*moves)[i]);
+  }
+
+  *validated = header.version == GAME_FILE_VERSION && (header.flags & GAME_FLAG_VALIDATED);
+
+  counted_free(data);
+  return header.plyCount;
+}
+
+void load_data(Move **moves, int *gameLength) {
+  int game_length, validated = 0;
+  uint32_t magic = 0;
+  char filename[50];
+
+  read_filename(filename);
+
+  FILE *fp;
+  fp = fopen(filename, "rb");
+
+  if (!fp) {
+    printf("\nThere's no such file!\n\n");
+    return;
+  }
+
+  // the record is replaced whether the file loads or not
+  *gameLength = 0;
+  reset_session(moves);
+
+  if (fread(&magic, sizeof(magic), 1, fp) == 1 && magic == GAME_FILE_MAGIC) {
+    game_length = load_binary_game(fp, moves, &validated);
+    fclose(fp);
+  } else if (magic == ARCHIVE_MAGIC) {
+    fclose(fp);
+    game_length = load_archive_game(filename, moves, &validated);
+  } else if (has_extension(filename, PGN_EXT)) {
+    fclose(fp);
+    game_length = load_pgn_game(filename, moves);
+    validated = 1;
+  } else {
+    fclose(fp);
+    game_length = load_text_game(filename, moves);
+  }
+
+  if (game_length == -2) {
+    printf("\nUnable to load game since castling and other start positions aren't supported\n\n");
+    *gameLength = 0;
+    free_memory(moves);
+    return;
+  }
+
+  if (game_length < 0) {
+    printf("\nUnable to load game since the file is damaged\n\n");
+    *gameLength = 0;
+    free_memory(moves);
+    return;
+  }
+
+  // a checksummed file that was validated when saved doesn't need the replay
+  if (!validated && !validate_record(*moves, game_length)) {
+    printf("\nUnable to load game since it has illegal moves\n\n");
+    *gameLength = 0;
+    free_memory(moves);
+    return;
+  }
+
+  printf("\nGame was loaded succesfully!\n\n");
+
+  *gameLength = game_length;
+}
+
+void edit_prompt(Move **moves, int *gameLength) {
+  int option;
+
+  while (1) {
+    // the menu and whatever the option prints push the board off its place
+    invalidate_frame();
+    printf("Select an option:\n");
+    printf("  1. View the record\n");
+    printf("  2. Continue editing the record\n");
+    printf("  3. Insert moves to the record\n");
+    printf("  4. Remove moves from the record\n");
+    printf("  5. Return to menu\n\n> ");
+
+    while (scanf("%d", &option) != 1) {
+      printf("Wrong input! Try again...\n> ");
+      fflush(stdin);
+    }
+
+    switch (option) {
+      case 1:
+        view_record(*moves, gameLength);
+        break;
+      case 2:
+        continue_editing(moves, gameLength);
+        break;
+      case 3:
+        insert_in_record(moves, gameLength);
+        break;
+      case 4:
+        remove_from_record(moves, gameLength);
+        break;
+      case 5:
+        return;
+        break;
+      default:
+        printf("There's no such option. Try again...\n> ");
+        break;
+    }
+    fflush(stdin);
+  }
+}
+
+// Validation cache: hash of a game's packed moves -> result of replaying it.
+// Stored as a header and an array of entries; a rules version change drops it.
+// Version 2: sliders capture and the king starts on the e-file. Version 3: pawns don't
+// jump over a piece and kings can't stand next to each other.
+#define VALIDATION_CACHE_MAGIC 0x43564c4c // "LLVC"
+#define VALIDATION_RULES_VERSION 3
+
+typedef struct {
+  uint32_t magic;
+  uint32_t rulesVersion;
+  uint64_t count;
+  uint32_t crc; // CRC-32 of the entries
+  uint32_t reserved;
+} ValidationCacheHeader;
+
+typedef struct {
+  uint64_t hash; // 0 marks an empty slot
+  uint32_t legalPlies;
+  uint32_t status; // MoveStatus of the first illegal move, MOVE_OK if the game is legal
+} ValidationCacheEntry;
+
+typedef struct {
+  ValidationCacheEntry *slots;
+  uint64_t capacity; // power of two
+  uint64_t count;
+  uint64_t hits, misses;
+} ValidationCache;
+
+// FNV-1a over the moves, seeded with the ply count
+uint64_t hash_moves(const PackedMove *packed, uint32_t plyCount) {
+  const unsigned char *bytes = (const unsigned char *) packed;
+  uint64_t hash = 0xcbf29ce484222325 ^ plyCount;
+
+  for (size_t i = 0; i < plyCount * sizeof(PackedMove); i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3;
+  }
+
+  return hash ? hash : 1;
+}
+
+ValidationCacheEntry *cache_slot(ValidationCache *cache, uint64_t hash) {
+  uint64_t i = hash & (cache->capacity - 1);
+
+  while (cache->slots[i].hash && cache->slots[i].hash != hash) {
+    i = (i + 1) & (cache->capacity - 1);
+  }
+
+  return &cache->slots[i];
+}
+
+int cache_grow(ValidationCache *cache) {
+  ValidationCache grown = *cache;
+
+  grown.capacity = cache->capacity ? cache->capacity * 2 : 1024;
+  grown.slots = calloc(grown.capacity, sizeof(ValidationCacheEntry));
+  if (!grown.slots) {
+    return 0;
+  }
+
+  for (uint64_t i = 0; i < cache->capacity; i++) {
+    if (cache->slots[i].hash) {
+      *cache_slot(&grown, cache->slots[i].hash) = cache->slots[i];
+    }
+  }
+
+  free(cache->slots);
+  *cache = grown;
+  return 1;
+}
+
+void cache_insert(ValidationCache *cache, ValidationCacheEntry *entry) {
+  // 0 would look like an empty slot and be counted again on every insert
+  if (!entry->hash) {
+    return;
+  }
+
+  // keep the table at most half full
+  if ((cache->count + 1) * 2 > cache->capacity && !cache_grow(cache)) {
+    return;
+  }
+
+  ValidationCacheEntry *slot = cache_slot(cache, entry->hash);
+  if (!slot->hash) {
+    cache->count++;
+  }
+  *slot = *entry;
+}
+
+// A missing, outdated or damaged cache file gives an empty cache
+void cache_load(ValidationCache *cache, const char *filename) {
+  ValidationCacheHeader header;
+  ValidationCacheEntry entry;
+  FILE *fp = fopen(filename, "rb");
+  uint64_t i = 0;
+  uint32_t crc = 0;
+  int valid = 1;
+
+  memset(cache, 0, sizeof(*cache));
+  cache_grow(cache);
+
+  if (!fp) {
+    return;
+  }
+
+  if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != VALIDATION_CACHE_MAGIC ||
+      header.rulesVersion != VALIDATION_RULES_VERSION) {
+    fclose(fp);
+    return;
+  }
+
+  for (; i < header.count && valid && fread(&entry, sizeof(entry), 1, fp) == 1; i++) {
+    crc = crc32_update(crc, &entry, sizeof(entry));
+    valid = entry.hash && entry.status < MOVE_STATUS_COUNT;
+    cache_insert(cache, &entry);
+  }
+  fclose(fp);
+
+  // a short or damaged file could hand out wrong results, start over instead
+  if (!valid || i != header.count || crc != header.crc) {
+    free(cache->slots);
+    memset(cache, 0, sizeof(*cache));
+    cache_grow(cache);
+  }
+}
+
+int cache_save(ValidationCache *cache, const char *filename) {
+  ValidationCacheHeader header;
+  FILE *fp = fopen(filename, "wb");
+
+  if (!fp) {
+    return 0;
+  }
+
+  header.magic = VALIDATION_CACHE_MAGIC;
+  header.rulesVersion = VALIDATION_RULES_VERSION;
+  header.count = cache->count;
+  header.crc = 0;
+  header.reserved = 0;
+
+  // the header goes first with a placeholder CRC and is rewritten once it is known
+  int ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+  for (uint64_t i = 0; i < cache->capacity && ok; i++) {
+    if (cache->slots[i].hash) {
+      header.crc = crc32_update(header.crc, &cache->slots[i], sizeof(ValidationCacheEntry));
+      ok = fwrite(&cache->slots[i], sizeof(ValidationCacheEntry), 1, fp) == 1;
+    }
+  }
+  ok = ok && fseek(fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, fp) == 1;
+
+  return fclose(fp) == 0 && ok;
+}
+
+// Replays the game from the initial position unless the cache already knows the result
+uint32_t validate_packed_cached(ValidationCache *cache, const PackedMove *packed, uint32_t plyCount, MoveStatus *status) {
+  GameState state;
+  ValidationCacheEntry entry;
+
+  entry.hash = hash_moves(packed, plyCount);
+
+  if (cache) {
+    ValidationCacheEntry *slot = cache_slot(cache, entry.hash);
+    if (slot->hash) {
+      cache->hits++;
+      *status = slot->status;
+      return slot->legalPlies;
+    }
+    cache->misses++;
+  }
+
+  initializeBoard(&state);
+  entry.legalPlies = replay_packed(&state, packed, plyCount, status);
+  entry.status = *status;
+
+  if (cache) {
+    cache_insert(cache, &entry);
+  }
+
+  return entry.legalPlies;
+}
+
+double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Parses a whole command line argument as a decimal number (or 0x hex when base is 0);
+// returns 0 on signs, stray characters or overflow
+int parse_unsigned(const char *text, int base, uint64_t *value) {
+  char *end;
+
+  if (!isdigit((unsigned char) *text)) {
+    return 0;
+  }
+  errno = 0;
+  *value = strtoull(text, &end, base);
+  return !errno && *end == '\0';
+}
+
+// lw10 replay <archive> <game> [ply]
+int command_replay(int argc, char **argv) {
+  MappedArchive ar;
+  ArchiveEntry entry;
+  GameState state;
+  uint64_t k, ply = UINT64_MAX;
+
+  if (argc < 4 || !parse_unsigned(argv[3], 10, &k) || (argc > 4 && !parse_unsigned(argv[4], 10, &ply))) {
+    fprintf(stderr, "usage: %s replay <archive> <game> [ply]\n", argv[0]);
+    return 2;
+  }
+
+  if (!archive_map(argv[2], &ar)) {
+    fprintf(stderr, "Unable to open archive %s\n", argv[2]);
+    return 1;
+  }
+
+  const PackedMove *packed = k ? mapped_game(&ar, k - 1, &entry) : NULL;
+
+  if (!packed) {
+    fprintf(stderr, "There's no game %s in the archive (%llu games)\n", argv[3], (unsigned long long) ar.gameCount);
+    archive_unmap(&ar);
+    return 1;
+  }
+
+  // without a ply (or past the end) the whole game is replayed
+  uint32_t plies = ply < entry.plyCount ? ply : entry.plyCount;
+
+  initializeBoard(&state);
+  uint32_t played = replay_packed(&state, packed, plies, NULL);
+
+  char fen[FEN_SIZE];
+  dumpFen(&state, fen, sizeof(fen));
+  displayBoard(&state);
+  printf("FEN: %s\n", fen);
+  if (played < plies) {
+    printf("Move %u is illegal, the board is shown before it\n", played + 1);
+  }
+
+  archive_unmap(&ar);
+  return played < plies;
+}
+
+// lw10 board "<fen>" [moves...]: seeds a position from FEN instead of replaying to it,
+// plays the given moves (e.g. e2e4) on it and prints the resulting position
+int command_board(int argc, char **argv) {
+  GameState state;
+  LegalSet legal;
+  Move move;
+  char fen[FEN_SIZE];
+
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s board \"<fen>\" [moves...]\n", argv[0]);
+    return 2;
+  }
+
+  if (!loadFen(&state, argv[2])) {
+    fprintf(stderr, "Invalid FEN: %s\n", argv[2]);
+    return 1;
+  }
+
+  for (int i = 3; i < argc; i++) {
+    if (strlen(argv[i]) < 4 || !parseMove(argv[i])) {
+      fprintf(stderr, "Wrong move format: %s\n", argv[i]);
+      return 1;
+    }
+    load_move(argv[i], &move);
+    if (playMove(&state, &move) != MOVE_OK) {
+      fprintf(stderr, "Move %d is illegal in this position\n", i - 2);
+      return 1;
+    }
+  }
+
+  // only a made up position has more pieces with moves than the set holds
+  int complete = generate_legal_set(&state, &legal);
+  int count = 0;
+  for (int i = 0; i < LEGAL_SET_PIECES; i++) {
+    count += __builtin_popcountll(legal.targets[i]);
+  }
+
+  dumpFen(&state, fen, sizeof(fen));
+  displayBoard(&state);
+  printf("FEN: %s\n", fen);
+  if (!complete) {
+    printf("Legal moves: unknown, more than %d pieces can move\n", LEGAL_SET_PIECES);
+    return 1;
+  }
+  printf("Legal moves: %d\n", count);
+  return 0;
+}
+
+// lw10 check <archive> [cache]: validates every game of the archive; with a cache
+// file, games whose moves were validated before aren't replayed again
+int command_check(int argc, char **argv) {
+  MappedArchive ar;
+  ArchiveEntry entry;
+  ValidationCache cache;
+  MoveStatus status;
+  uint64_t plies = 0, damaged = 0, illegal = 0;
+
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s check <archive> [cache]\n", argv[0]);
+    return 2;
+  }
+
+  if (!archive_map(argv[2], &ar)) {
+    fprintf(stderr, "Unable to open archive %s\n", argv[2]);
+    return 1;
+  }
+
+  double start = now_seconds();
+
+  if (argc > 3) {
+    cache_load(&cache, argv[3]);
+  }
+
+  for (uint64_t k = 0; k < ar.gameCount; k++) {
+    const PackedMove *packed = mapped_game(&ar, k, &entry);
+
+    if (!packed || crc32(packed, entry.plyCount * sizeof(PackedMove)) != entry.crc) {
+      printf("Game %llu is damaged\n", (unsigned long long) k + 1);
+      damaged++;
+      continue;
+    }
+
+    uint32_t played = validate_packed_cached(argc > 3 ? &cache : NULL, packed, entry.plyCount, &status);
+    if (played < entry.plyCount) {
+      printf("Game %llu: move %u is illegal (%s)\n", (unsigned long long) k + 1, played + 1, MOVE_STATUS_TEXT[status]);
+      illegal++;
+    }
+    plies += entry.plyCount;
+  }
+
+  double elapsed = now_seconds() - start;
+
+  printf("%llu games, %llu plies, %llu damaged, %llu illegal in %.3f s (%.0f games/s)\n",
+         (unsigned long long) ar.gameCount, (unsigned long long) plies,
+         (unsigned long long) damaged, (unsigned long long) illegal,
+         elapsed, elapsed > 0 ? ar.gameCount / elapsed : 0);
+
+  if (argc > 3) {
+    uint64_t lookups = cache.hits + cache.misses;
+    printf("Validation cache: %llu hits, %llu misses (%.1f%% hit rate), %llu entries\n",
+           (unsigned long long) cache.hits, (unsigned long long) cache.misses,
+           lookups ? 100.0 * cache.hits / lookups : 0, (unsigned long long) cache.count);
+    if (!cache_save(&cache, argv[3])) {
+      fprintf(stderr, "Unable to write cache %s\n", argv[3]);
+    }
+    free(cache.slots);
+  }
+
+  archive_unmap(&ar);
+  return damaged || illegal;
+}
+
+#define BENCH_CHUNK_MOVES 65536
+
+// Random coordinate moves, only meant for measuring the parsers
+int write_move_file(const char *filename, long long bytes) {
+  char buffer[65536];
+  uint64_t seed = 0x9e3779b97f4a7c15;
+  FILE *fp = fopen(filename, "wb");
+
+  if (!fp) {
+    return 0;
+  }
+
+  for (long long written = 0; written < bytes; written += sizeof(buffer) - sizeof(buffer) % 5) {
+    for (size_t i = 0; i + 5 <= sizeof(buffer); i += 5) {
+      seed ^= seed << 13;
+      seed ^= seed >> 7;
+      seed ^= seed << 17;
+      buffer[i] = 'a' + (seed & 7);
+      buffer[i + 1] = '1' + (seed >> 3 & 7);
+      buffer[i + 2] = 'a' + (seed >> 6 & 7);
+      buffer[i + 3] = '1' + (seed >> 9 & 7);
+      buffer[i + 4] = '\n';
+    }
+    // 65536 isn't a multiple of 5, keep the last record whole
+    size_t used = sizeof(buffer) - sizeof(buffer) % 5;
+    if (fwrite(buffer, 1, used, fp) != used) {
+      fclose(fp);
+      return 0;
+    }
+  }
+
+  return fclose(fp) == 0;
+}
+
+long count_text_moves(const char *data, size_t size, void *arg) {
+  PackedMove *chunk = arg;
+  size_t pos = 0;
+  long total = 0;
+
+  while (pos < size) {
+    long parsed = parse_text_moves(data, size, &pos, chunk, BENCH_CHUNK_MOVES);
+    if (parsed < 0) {
+      return -1;
+    }
+    total += parsed;
+  }
+
+  return total;
+}
+
+// lw10 bench-load <file> [megabytes]: fscanf loader against the buffered one
+int command_bench_load(int argc, char **argv) {
+  struct stat st;
+  uint64_t megabytes = 1024;
+
+  // the size in bytes has to fit a long long
+  if (argc < 3 || (argc > 3 && (!parse_unsigned(argv[3], 10, &megabytes) || !megabytes ||
+                                 megabytes > LLONG_MAX / (1024 * 1024)))) {
+    fprintf(stderr, "usage: %s bench-load <file> [megabytes]\n", argv[0]);
+    return 2;
+  }
+
+  if (stat(argv[2], &st) || (uint64_t) st.st_size < megabytes * 1024 * 1024) {
+    printf("Generating %llu MB of moves in %s\n", (unsigned long long) megabytes, argv[2]);
+    if (!write_move_file(argv[2], (long long) megabytes * 1024 * 1024) || stat(argv[2], &st)) {
+      fprintf(stderr, "Unable to write %s\n", argv[2]);
+      return 1;
+    }
+  }
+
+  Move *chunk = malloc(BENCH_CHUNK_MOVES * sizeof(Move));
+  PackedMove *packedChunk = malloc(BENCH_CHUNK_MOVES * sizeof(PackedMove));
+  FILE *fp = fopen(argv[2], "r");
+  long stdioMoves = 0, parsed;
+
+  if (!chunk || !packedChunk || !fp) {
+    free(chunk);
+    free(packedChunk);
+    return 1;
+  }
+
+  double start = now_seconds();
+  while ((parsed = read_text_moves_stdio(fp, chunk, BENCH_CHUNK_MOVES)) > 0) {
+    stdioMoves += parsed;
+  }
+  double stdioTime = now_seconds() - start;
+  fclose(fp);
+
+  start = now_seconds();
+  long bufferedMoves = with_file_contents(argv[2], count_text_moves, packedChunk);
+  double bufferedTime = now_seconds() - start;
+
+  double mb = st.st_size / (1024.0 * 1024.0);
+  printf("fscanf:   %ld moves in %.3f s, %.1f MB/s\n", stdioMoves, stdioTime, mb / stdioTime);
+  printf("buffered: %ld moves in %.3f s, %.1f MB/s\n", bufferedMoves, bufferedTime, mb / bufferedTime);
+
+  free(chunk);
+  free(packedChunk);
+  return stdioMoves != bufferedMoves;
+}
+
+// Parallel parsing of one big text file: each thread parses its own slice into
+// its own buffer, then after a barrier copies it to its place in the result.
+typedef struct IngestJob IngestJob;
+
+typedef struct {
+  IngestJob *job;
+  size_t begin, end;
+  PackedMove *moves;
+  long count;
+  long offset; // position of this slice's moves in the result
+  size_t errorPos;
+} IngestSlice;
+
+struct IngestJob {
+  const char *data;
+  size_t size;
+  int threads;
+  IngestSlice *slices;
+  // workers wait here until the slices are laid out for the threads that did start
+  pthread_mutex_t lock;
+  pthread_cond_t go;
+  int ready;
+  pthread_barrier_t barrier;
+  PackedMove *result;
+  long total;
+};
+
+void *ingest_worker(void *arg) {
+  IngestSlice *slice = arg;
+  IngestJob *job = slice->job;
+
+  pthread_mutex_lock(&job->lock);
+  while (!job->ready) {
+    pthread_cond_wait(&job->go, &job->lock);
+  }
+  pthread_mutex_unlock(&job->lock);
+
+  size_t pos = slice->begin;
+  long capacity = text_moves_capacity(slice->end - slice->begin);
+
+  slice->moves = malloc(capacity * sizeof(PackedMove));
+  slice->count = slice->moves ? parse_text_moves(job->data, slice->end, &pos, slice->moves, capacity) : -1;
+  slice->errorPos = slice->moves ? pos : SIZE_MAX;
+
+  // the last thread to arrive lays out the result
+  if (pthread_barrier_wait(&job->barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+    job->total = 0;
+    for (int t = 0; t < job->threads && job->total >= 0; t++) {
+      job->slices[t].offset = job->total;
+      job->total = job->slices[t].count < 0 ? -1 : job->total + job->slices[t].count;
+    }
+    job->result = job->total >= 0 ? malloc(job->total * sizeof(PackedMove) + 1) : NULL;
+  }
+  pthread_barrier_wait(&job->barrier);
+
+  if (job->result) {
+    memcpy(job->result + slice->offset, slice->moves, slice->count * sizeof(PackedMove));
+  }
+
+  free(slice->moves);
+  return NULL;
+}
+
+// Splits data at line boundaries into one slice per thread and parses them in parallel.
+// If some threads can't be started, the work is split between the ones that did and
+// *threads is lowered to their count.
+// Returns the number of moves stored in *moves (in file order), -1 on a malformed move
+// with *errorPos set to its offset, or -1 with *errorPos set to SIZE_MAX when out of memory.
+long parse_text_parallel(const char *data, size_t size, int *threadCount, PackedMove **moves, size_t *errorPos) {
+  IngestJob job;
+  int threads = *threadCount;
+  pthread_t *ids = malloc(threads * sizeof(pthread_t));
+
+  job.data = data;
+  job.size = size;
+  job.slices = calloc(threads, sizeof(IngestSlice));
+  job.result = NULL;
+  job.ready = 0;
+  *moves = NULL;
+  *errorPos = SIZE_MAX;
+
+  if (!ids || !job.slices) {
+    free(ids);
+    free(job.slices);
+    return -1;
+  }
+
+  pthread_mutex_init(&job.lock, NULL);
+  pthread_cond_init(&job.go, NULL);
+
+  // thread 0 is this one
+  int started = 1;
+  for (; started < threads; started++) {
+    job.slices[started].job = &job;
+    if (pthread_create(&ids[started], NULL, ingest_worker, &job.slices[started])) {
+      break;
+    }
+  }
+  job.threads = started;
+  *threadCount = started;
+
+  size_t begin = 0;
+  for (int t = 0; t < started; t++) {
+    size_t end = t == started - 1 ? size : size / started * (t + 1);
+    if (end < begin) {
+      end = begin;
+    }
+    if (end < size) {
+      const char *newline = memchr(data + end, '\n', size - end);
+      end = newline ? (size_t) (newline - data) + 1 : size;
+    }
+    job.slices[t].job = &job;
+    job.slices[t].begin = begin;
+    job.slices[t].end = end;
+    begin = end;
+  }
+
+  pthread_barrier_init(&job.barrier, NULL, started);
+  pthread_mutex_lock(&job.lock);
+  job.ready = 1;
+  pthread_cond_broadcast(&job.go);
+  pthread_mutex_unlock(&job.lock);
+
+  ingest_worker(&job.slices[0]);
+  for (int t = 1; t < started; t++) {
+    pthread_join(ids[t], NULL);
+  }
+  pthread_barrier_destroy(&job.barrier);
+  pthread_cond_destroy(&job.go);
+  pthread_mutex_destroy(&job.lock);
+
+  for (int t = 0; t < started; t++) {
+    if (job.slices[t].count < 0) {
+      *errorPos = job.slices[t].errorPos;
+      break;
+    }
+  }
+
+  *moves = job.result;
+  free(ids);
+  free(job.slices);
+  return job.result ? job.total : -1;
+}
+
+typedef struct {
+  int threads;
+  PackedMove *moves;
+  size_t errorPos;
+} IngestArgs;
+
+long ingest_buffer(const char *data, size_t size, void *arg) {
+  IngestArgs *args = arg;
+  return parse_text_parallel(data, size, &args->threads, &args->moves, &args->errorPos);
+}
+
+// lw10 ingest <file> [threads]: parses a big text file of moves on several threads
+int command_ingest(int argc, char **argv) {
+  struct stat st;
+  IngestArgs args;
+  long online = sysconf(_SC_NPROCESSORS_ONLN);
+  uint64_t threads = online > 0 ? online : 1;
+
+  if (argc < 3 || (argc > 3 && (!parse_unsigned(argv[3], 10, &threads) || threads < 1 || threads > INT_MAX))) {
+    fprintf(stderr, "usage: %s ingest <file> [threads]\n", argv[0]);
+    return 2;
+  }
+
+  args.threads = threads;
+  args.moves = NULL;
+  args.errorPos = SIZE_MAX; // stays there if the file can't be read
+
+  if (stat(argv[2], &st)) {
+    fprintf(stderr, "There's no such file %s\n", argv[2]);
+    return 1;
+  }
+
+  double start = now_seconds();
+  long count = with_file_contents(argv[2], ingest_buffer, &args);
+  double elapsed = now_seconds() - start;
+
+  if (count < 0 && args.errorPos == SIZE_MAX) {
+    fprintf(stderr, "Unable to read %s or not enough memory to parse it\n", argv[2]);
+    return 1;
+  }
+  if (count < 0) {
+    fprintf(stderr, "Unable to parse %s (bad move at byte %zu)\n", argv[2], args.errorPos);
+    free(args.moves);
+    return 1;
+  }
+
+  printf("%ld moves on %d threads in %.3f s, %.1f MB/s\n", count, args.threads, elapsed,
+         st.st_size / (1024.0 * 1024.0) / elapsed);
+
+  free(args.moves);
+  return 0;
+}
+
+// Bounded lock-free ring for exactly one producer and one consumer thread.
+// head and tail sit on separate cache lines so the two sides don't share one.
+#define RING_SLOTS 64
+
+typedef struct {
+  _Alignas(64) _Atomic size_t head; // next slot to pop, written by the consumer
+  _Alignas(64) _Atomic size_t tail; // next slot to push, written by the producer
+  _Atomic int closed;
+  void *slots[RING_SLOTS];
+  // producer side counters
+  uint64_t pushes, fullWaits, depthSum, maxDepth;
+  // consumer side counters
+  uint64_t emptyWaits;
+} SpscRing;
+
+void ring_init(SpscRing *ring) {
+  memset(ring, 0, sizeof(*ring));
+}
+
+// Blocks (yielding) while the ring is full, which is what throttles a fast producer
+void ring_push(SpscRing *ring, void *item) {
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  size_t head;
+
+  while (tail - (head = atomic_load_explicit(&ring->head, memory_order_acquire)) == RING_SLOTS) {
+    ring->fullWaits++;
+    sched_yield();
+  }
+
+  ring->slots[tail % RING_SLOTS] = item;
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+  uint64_t depth = tail + 1 - head;
+  ring->pushes++;
+  ring->depthSum += depth;
+  if (depth > ring->maxDepth) {
+    ring->maxDepth = depth;
+  }
+}
+
+// No more items will be pushed
+void ring_close(SpscRing *ring) {
+  atomic_store_explicit(&ring->closed, 1, memory_order_release);
+}
+
+// Blocks while the ring is empty; NULL once it is closed and drained
+void *ring_pop(SpscRing *ring) {
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+  while (atomic_load_explicit(&ring->tail, memory_order_acquire) == head) {
+    if (atomic_load_explicit(&ring->closed, memory_order_acquire) &&
+        atomic_load_explicit(&ring->tail, memory_order_acquire) == head) {
+      return NULL;
+    }
+    ring->emptyWaits++;
+    sched_yield();
+  }
+
+  void *item = ring->slots[head % RING_SLOTS];
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+  return item;
+}
+
+// Ingest pipeline: read -> parse -> validate -> write, one thread per stage.
+// A batch holds whole games (separated by blank lines) and travels through every stage.
+#define PIPELINE_BLOCK (1 << 20)
+// text without a blank line is cut at a line end once it gets this long
+#define PIPELINE_MAX_BATCH (16 * PIPELINE_BLOCK)
+
+typedef struct {
+  char *text;
+  size_t size;
+  PackedMove *moves;
+  uint32_t *gameStart; // gameCount + 1 offsets into moves
+  uint32_t *legalPlies; // plies before the first illegal move of each game
+  uint32_t gameCount;
+} PipelineBatch;
+
+typedef struct {
+  const char *name;
+  uint64_t batches, games, bytes;
+  double busy;
+} StageStats;
+
+typedef struct {
+  int fd;
+  Archive *archive;
+  SpscRing toParse, toValidate, toWrite;
+  StageStats read, parse, validate, write;
+  uint64_t illegalGames, badGames;
+  int writeFailed;
+  _Atomic int failed; // a read error or a stage out of memory, the archive misses games
+} Pipeline;
+
+void free_batch(PipelineBatch *batch) {
+  free(batch->text);
+  free(batch->moves);
+  free(batch->gameStart);
+  free(batch->legalPlies);
+  free(batch);
+}
+
+// Whether the line starting at pos holds nothing but blanks (a game separator)
+int is_separator_line(const char *data, size_t size, size_t pos) {
+  while (pos < size && data[pos] != '\n' && is_blank(data[pos])) {
+    pos++;
+  }
+  return pos == size || data[pos] == '\n';
+}
+
+// Offset just past the last blank or whitespace only line that ends after from, 0 if
+// there is none. Lines are checked backwards from their newline, so ordinary lines
+// stop the check at their last character and bytes before from are barely read.
+size_t last_game_boundary(const char *data, size_t from, size_t size) {
+  for (size_t i = size; i > from; i--) {
+    if (data[i - 1] != '\n') {
+      continue;
+    }
+    size_t j = i - 1;
+    while (j > 0 && data[j - 1] != '\n' && is_blank(data[j - 1])) {
+      j--;
+    }
+    if (j > 0 && data[j - 1] == '\n') {
+      return i;
+    }
+  }
+  return 0;
+}
+
+void *pipeline_read(void *arg) {
+  Pipeline *p = arg;
+  size_t capacity = PIPELINE_BLOCK, size = 0, scanned = 0;
+  char *text = malloc(capacity);
+  int eof = 0;
+
+  if (!text) {
+    atomic_store_explicit(&p->failed, 1, memory_order_relaxed);
+  }
+
+  while (text && !eof) {
+    double start = now_seconds();
+    size_t want = size + PIPELINE_BLOCK;
+    ssize_t got = 0;
+
+    // a batch still without a game boundary keeps growing, the buffer doubles
+    if (want > capacity) {
+      size_t grown = capacity * 2 > want ? capacity * 2 : want;
+      char *bigger = realloc(text, grown);
+      if (!bigger) {
+        atomic_store_explicit(&p->failed, 1, memory_order_relaxed);
+        break;
+      }
+      text = bigger;
+      capacity = grown;
+    }
+
+    while (size < want && (got = read(p->fd, text + size, want - size)) > 0) {
+      size += got;
+    }
+    eof = size < want;
+    if (got < 0) {
+      atomic_store_explicit(&p->failed, 1, memory_order_relaxed);
+    }
+
+    // only whole games go downstream, the tail waits for the next block;
+    // only the bytes read now are searched for the boundary
+    size_t boundary = eof ? size : last_game_boundary(text, scanned, size);
+    if (!boundary && size >= PIPELINE_MAX_BATCH) {
+      boundary = size;
+      while (boundary > 0 && text[boundary - 1] != '\n') {
+        boundary--;
+      }
+    }
+    scanned = size;
+    p->read.busy += now_seconds() - start;
+
+    if (!boundary) {
+      continue;
+    }
+
+    size_t carrySize = size - boundary;
+    char *next = eof ? NULL : malloc(carrySize + PIPELINE_BLOCK);
+    PipelineBatch *batch = calloc(1, sizeof(PipelineBatch));
+
+    if ((!eof && !next) || !batch) {
+      free(next);
+      free(batch);
+      atomic_store_explicit(&p->failed, 1, memory_order_relaxed);
+      break;
+    }
+    if (carrySize) {
+      memcpy(next, text + boundary, carrySize);
+    }
+
+    batch->text = text;
+    batch->size = boundary;
+    p->read.batches++;
+    p->read.bytes += boundary;
+    ring_push(&p->toParse, batch);
+
+    text = next;
+    capacity = carrySize + PIPELINE_BLOCK;
+    size = scanned = carrySize;
+  }
+
+  free(text);
+  ring_close(&p->toParse);
+  return NULL;
+}
+
+void *pipeline_parse(void *arg) {
+  Pipeline *p = arg;
+  PipelineBatch *batch;
+
+  while ((batch = ring_pop(&p->toParse))) {
+    double start = now_seconds();
+    long capacity = text_moves_capacity(batch->size);
+    // at most one game per two bytes of text (a move and a blank line)
+    uint32_t maxGames = batch->size / 2 + 1;
+    size_t pos = 0;
+
+    batch->moves = malloc(capacity * sizeof(PackedMove));
+    batch->gameStart = malloc((maxGames + 1) * sizeof(uint32_t));
+    batch->gameCount = 0;
+
+    if (!batch->moves || !batch->gameStart) {
+      atomic_store_explicit(&p->failed, 1, memory_order_relaxed);
+      free_batch(batch);
+      continue;
+    }
+
+    long count = 0;
+    while (pos < batch->size) {
+      size_t end = pos;
+      // a game ends at a blank or whitespace only line
+      while (end < batch->size) {
+        const char *newline = memchr(batch->text + end, '\n', batch->size - end);
+        if (!newline) {
+          end = batch->size;
+          break;
+        }
+        end = newline - batch->text + 1;
+        if (end < batch->size && is_separator_line(batch->text, batch->size, end)) {
+          break;
+        }
+      }
+
+      size_t gamePos = pos;
+      long parsed = parse_text_moves(batch->text, end, &gamePos, batch->moves + count, capacity - count);
+      if (parsed > 0) {
+        batch->gameStart[batch->gameCount++] = count;
+        count += parsed;
+      } else if (parsed < 0) {
+        p->badGames++;
+      }
+
+      pos = end;
+      while (pos < batch->size && is_blank(batch->text[pos])) {
+        pos++;
+      }
+    }
+    batch->gameStart[batch->gameCount] = count;
+
+    free(batch->text);
+    batch->text = NULL;
+
+    p->parse.busy += now_seconds() - start;
+    p->parse.batches++;
+    p->parse.games += batch->gameCount;
+    p->parse.bytes += batch->size;
+    ring_push(&p->toValidate, batch);
+  }
+
+  ring_close(&p->toValidate);
+  return NULL;
+}
+
+void *pipeline_validate(void *arg) {
+  Pipeline *p = arg;
+  PipelineBatch *batch;
+  GameState state;
+
+  while ((batch = ring_pop(&p->toValidate))) {
+    double start = now_seconds();
+
+    batch->legalPlies = malloc((batch->gameCount + 1) * sizeof(uint32_t));
+    if (!batch->legalPlies) {
+      atomic_store_explicit(&p->failed, 1, memory_order_relaxed);
+      free_batch(batch);
+      continue;
+    }
+    for (uint32_t g = 0; g < batch->gameCount; g++) {
+      uint32_t plies = batch->gameStart[g + 1] - batch->gameStart[g];
+      initializeBoard(&state);
+      batch->legalPlies[g] = replay_packed(&state, batch->moves + batch->gameStart[g], plies, NULL);
+      if (batch->legalPlies[g] < plies) {
+        p->illegalGames++;
+      }
+    }
+
+    p->validate.busy += now_seconds() - start;
+    p->validate.batches++;
+    p->validate.games += batch->gameCount;
+    ring_push(&p->toWrite, batch);
+  }
+
+  ring_close(&p->toWrite);
+  return NULL;
+}
+
+void *pipeline_write(void *arg) {
+  Pipeline *p = arg;
+  PipelineBatch *batch;
+
+  while ((batch = ring_pop(&p->toWrite))) {
+    double start = now_seconds();
+
+    for (uint32_t g = 0; g < batch->gameCount && !p->writeFailed; g++) {
+      uint32_t plies = batch->gameStart[g + 1] - batch->gameStart[g];
+      if (!archive_append_packed(p->archive, batch->moves + batch->gameStart[g], plies,
+                                 batch->legalPlies[g] == plies)) {
+        p->writeFailed = 1;
+      }
+      p->write.bytes += plies * sizeof(PackedMove);
+    }
+
+    p->write.busy += now_seconds() - start;
+    p->write.batches++;
+    p->write.games += batch->gameCount;
+    free_batch(batch);
+  }
+
+  return NULL;
+}
+
+void print_stage(StageStats *stage, SpscRing *input, double elapsed) {
+  printf("  %-9s %8llu batches %10llu games %9.1f MB  busy %6.3f s  %8.0f games/s",
+         stage->name, (unsigned long long) stage->batches, (unsigned long long) stage->games,
+         stage->bytes / (1024.0 * 1024.0), stage->busy, elapsed > 0 ? stage->games / elapsed : 0);
+  if (input) {
+    printf("  queue avg %.1f max %llu, full waits %llu, empty waits %llu",
+           input->pushes ? (double) input->depthSum / input->pushes : 0,
+           (unsigned long long) input->maxDepth, (unsigned long long) input->fullWaits,
+           (unsigned long long) input->emptyWaits);
+  }
+  printf("\n");
+}
+
+// lw10 pipeline <games.txt> <archive>: text games separated by blank lines are
+// parsed, validated and appended to the archive with the stages overlapping
+int command_pipeline(int argc, char **argv) {
+  Pipeline *p;
+  pthread_t stages[4];
+
+  if (argc < 4) {
+    fprintf(stderr, "usage: %s pipeline <games.txt> <archive>\n", argv[0]);
+    return 2;
+  }
+
+  p = calloc(1, sizeof(Pipeline));
+  if (!p) {
+    fprintf(stderr, "Not enough memory for the pipeline\n");
+    return 1;
+  }
+
+  p->fd = open(argv[2], O_RDONLY);
+  if (p->fd < 0) {
+    fprintf(stderr, "There's no such file %s\n", argv[2]);
+    free(p);
+    return 1;
+  }
+
+  p->archive = archive_open(argv[3], 1);
+  if (!p->archive) {
+    fprintf(stderr, "Unable to open archive %s\n", argv[3]);
+    close(p->fd);
+    free(p);
+    return 1;
+  }
+
+  ring_init(&p->toParse);
+  ring_init(&p->toValidate);
+  ring_init(&p->toWrite);
+  p->read.name = "read";
+  p->parse.name = "parse";
+  p->validate.name = "validate";
+  p->write.name = "write";
+
+  void *(*run[4])(void *) = {pipeline_read, pipeline_parse, pipeline_validate, pipeline_write};
+  SpscRing *output[4] = {&p->toParse, &p->toValidate, &p->toWrite, NULL};
+  int first = 0;
+
+  double start = now_seconds();
+  // consumers start first: if a stage can't start, closing its output ring lets the
+  // stages after it drain and stop
+  for (int i = 3; i >= 0 && !first; i--) {
+    if (pthread_create(&stages[i], NULL, run[i], p)) {
+      if (output[i]) {
+        ring_close(output[i]);
+      }
+      atomic_store_explicit(&p->failed, 1, memory_order_relaxed);
+      first = i + 1;
+    }
+  }
+  for (int i = first; i < 4; i++) {
+    pthread_join(stages[i], NULL);
+  }
+  int closed = archive_close(p->archive);
+  double elapsed = now_seconds() - start;
+
+  printf("%llu games (%llu illegal, %llu malformed) in %.3f s\n",
+         (unsigned long long) p->write.games, (unsigned long long) p->illegalGames,
+         (unsigned long long) p->badGames, elapsed);
+  print_stage(&p->read, NULL, elapsed);
+  print_stage(&p->parse, &p->toParse, elapsed);
+  print_stage(&p->validate, &p->toValidate, elapsed);
+  print_stage(&p->write, &p->toWrite, elapsed);
+
+  // the joins order the stages' stores before this load
+  int readFailed = atomic_load_explicit(&p->failed, memory_order_relaxed);
+  int failed = p->writeFailed || !closed || readFailed;
+  if (readFailed) {
+    fprintf(stderr, "Unable to read all of %s (out of memory, a read error or no threads)\n", argv[2]);
+  }
+  if (p->writeFailed || !closed) {
+    fprintf(stderr, "Unable to write archive %s\n", argv[3]);
+  }
+
+  close(p->fd);
+  free(p);
+  return failed;
+}
+
+// Directory ingest: every regular file holds one text game (like testfile.txt)
+#define DIR_INGEST_SLOTS 64
+#define DIR_INGEST_BUFFER 4096
+
+typedef struct {
+  char **names;
+  size_t count;
+} FileList;
+
+void free_file_list(FileList *list) {
+  for (size_t i = 0; i < list->count; i++) {
+    free(list->names[i]);
+  }
+  free(list->names);
+}
+
+int list_directory(const char *dirname, FileList *list) {
+  DIR *dir = opendir(dirname);
+  struct dirent *entry;
+  size_t capacity = 0;
+
+  if (!dir) {
+    return 0;
+  }
+
+  list->names = NULL;
+  list->count = 0;
+
+  while ((entry = readdir(dir))) {
+    if (entry->d_name[0] == '.' || (entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN)) {
+      continue;
+    }
+    if (list->count == capacity) {
+      size_t grown = capacity ? capacity * 2 : 256;
+      char **names = realloc(list->names, grown * sizeof(char *));
+      if (!names) {
+        break;
+      }
+      list->names = names;
+      capacity = grown;
+    }
+    size_t len = strlen(dirname) + strlen(entry->d_name) + 2;
+    if (!(list->names[list->count] = malloc(len))) {
+      break;
+    }
+    snprintf(list->names[list->count], len, "%s/%s", dirname, entry->d_name);
+    list->count++;
+  }
+
+  closedir(dir);
+
+  // out of memory part way through: a partial list would silently skip games
+  if (entry) {
+    free_file_list(list);
+    return 0;
+  }
+  return 1;
+}
+
+typedef struct {
+  Archive *archive;
+  pthread_mutex_t archiveLock; // only taken by the thread pool
+  uint64_t files, games, illegal, failed, bytes;
+  PackedMove *moves; // parse buffer reused from game to game, it only grows
+  long capacity;
+} DirIngest;
+
+// Parses, validates and archives one game straight from the read buffer;
+// lock, if given, is held only around the archive append
+void ingest_game_text(DirIngest *ingest, pthread_mutex_t *lock, const char *text, size_t size) {
+  GameState state;
+  size_t pos = 0;
+  long capacity = text_moves_capacity(size);
+
+  if (capacity > ingest->capacity) {
+    PackedMove *grown = realloc(ingest->moves, capacity * sizeof(PackedMove));
+    if (!grown) {
+      ingest->failed++;
+      return;
+    }
+    ingest->moves = grown;
+    ingest->capacity = capacity;
+  }
+
+  PackedMove *moves = ingest->moves;
+  long count = parse_text_moves(text, size, &pos, moves, capacity);
+
+  if (count <= 0) {
+    ingest->failed++;
+    return;
+  }
+
+  initializeBoard(&state);
+  int legal = replay_packed(&state, moves, count, NULL) == (uint32_t) count;
+
+  if (!legal) {
+    ingest->illegal++;
+  }
+
+  if (lock) {
+    pthread_mutex_lock(lock);
+  }
+  int appended = archive_append_packed(ingest->archive, moves, count, legal);
+  if (lock) {
+    pthread_mutex_unlock(lock);
+  }
+
+  if (appended) {
+    ingest->games++;
+  } else {
+    ingest->failed++;
+  }
+}
+
+#ifdef __linux__
+// Minimal io_uring setup over the raw system calls, there is no liburing dependency
+typedef struct {
+  int fd;
+  unsigned entries;
+  unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+  unsigned *cqHead, *cqTail, *cqMask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sqRing, *cqRing;
+  size_t sqRingSize, cqRingSize, sqesSize;
+  unsigned queued;
+} Uring;
+
+int uring_init(Uring *ring, unsigned entries) {
+  struct io_uring_params params;
+
+  memset(&params, 0, sizeof(params));
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (ring->fd < 0) {
+    return 0;
+  }
+
+  ring->entries = params.sq_entries;
+  ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP && ring->cqRingSize > ring->sqRingSize) {
+    ring->sqRingSize = ring->cqRingSize;
+  }
+
+  ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sqRing == MAP_FAILED) {
+    close(ring->fd);
+    return 0;
+  }
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->cqRing = ring->sqRing;
+  } else {
+    ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cqRing == MAP_FAILED) {
+      munmap(ring->sqRing, ring->sqRingSize);
+      close(ring->fd);
+      return 0;
+    }
+  }
+
+  ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    if (ring->cqRing != ring->sqRing) {
+      munmap(ring->cqRing, ring->cqRingSize);
+    }
+    munmap(ring->sqRing, ring->sqRingSize);
+    close(ring->fd);
+    return 0;
+  }
+
+  ring->sqHead = (unsigned *) ((char *) ring->sqRing + params.sq_off.head);
+  ring->sqTail = (unsigned *) ((char *) ring->sqRing + params.sq_off.tail);
+  ring->sqMask = (unsigned *) ((char *) ring->sqRing + params.sq_off.ring_mask);
+  ring->sqArray = (unsigned *) ((char *) ring->sqRing + params.sq_off.array);
+  ring->cqHead = (unsigned *) ((char *) ring->cqRing + params.cq_off.head);
+  ring->cqTail = (unsigned *) ((char *) ring->cqRing + params.cq_off.tail);
+  ring->cqMask = (unsigned *) ((char *) ring->cqRing + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *) ((char *) ring->cqRing + params.cq_off.cqes);
+
+  return 1;
+}
+
+void uring_free(Uring *ring) {
+  munmap(ring->sqes, ring->sqesSize);
+  if (ring->cqRing != ring->sqRing) {
+    munmap(ring->cqRing, ring->cqRingSize);
+  }
+  munmap(ring->sqRing, ring->sqRingSize);
+  close(ring->fd);
+}
+
+// Whether the kernel supports every opcode in ops; io_uring itself may be there
+// without the file operations (those came in 5.6)
+int uring_supports(Uring *ring, const int *ops, int count) {
+  size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe *probe = calloc(1, size);
+  int supported = probe && syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) >= 0;
+
+  for (int i = 0; i < count && supported; i++) {
+    supported = ops[i] < probe->ops_len && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+  }
+
+  free(probe);
+  return supported;
+}
+
+// The caller keeps at most one request per slot in flight, so the queue never overflows
+struct io_uring_sqe *uring_sqe(Uring *ring, uint64_t userData) {
+  unsigned tail = *ring->sqTail + ring->queued;
+  struct io_uring_sqe *sqe = &ring->sqes[tail & *ring->sqMask];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->user_data = userData;
+  ring->sqArray[tail & *ring->sqMask] = tail & *ring->sqMask;
+  ring->queued++;
+
+  return sqe;
+}
+
+// Submits the queued requests (and any the kernel didn't take last time) and waits
+// for at least one completion
+int uring_submit_and_wait(Uring *ring) {
+  __atomic_store_n(ring->sqTail, *ring->sqTail + ring->queued, __ATOMIC_RELEASE);
+  ring->queued = 0;
+
+  for (;;) {
+    unsigned toSubmit = *ring->sqTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+    if (syscall(__NR_io_uring_enter, ring->fd, toSubmit, 1, IORING_ENTER_GETEVENTS, NULL, 0) >= 0) {
+      return 1;
+    }
+    if (errno != EINTR) {
+      return 0;
+    }
+  }
+}
+
+typedef enum {
+  SLOT_FREE = 0,
+  SLOT_OPENING,
+  SLOT_READING,
+  SLOT_CLOSING,
+} SlotState;
+
+typedef struct {
+  SlotState state;
+  int fd;
+  char *buffer;
+  size_t capacity, size;
+} IngestSlot;
+
+// Returns 0 if the buffer can't grow, nothing is queued then
+int queue_read(Uring *ring, IngestSlot *slot, int index) {
+  if (slot->size == slot->capacity) {
+    char *grown = realloc(slot->buffer, slot->capacity * 2);
+    if (!grown) {
+      return 0;
+    }
+    slot->buffer = grown;
+    slot->capacity *= 2;
+  }
+
+  struct io_uring_sqe *sqe = uring_sqe(ring, index);
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = slot->fd;
+  sqe->addr = (uint64_t) (uintptr_t) (slot->buffer + slot->size);
+  sqe->len = slot->capacity - slot->size;
+  sqe->off = slot->size;
+  slot->state = SLOT_READING;
+  return 1;
+}
+
+void queue_close(Uring *ring, IngestSlot *slot, int index) {
+  struct io_uring_sqe *sqe = uring_sqe(ring, index);
+  sqe->opcode = IORING_OP_CLOSE;
+  sqe->fd = slot->fd;
+  slot->state = SLOT_CLOSING;
+}
+
+// Keeps up to DIR_INGEST_SLOTS files between open and close in flight; each finished
+// read buffer is parsed in place. Returns 0 if io_uring isn't usable here.
+// If the ring fails part way, the requests still in flight are waited for and their
+// files closed; every file that wasn't ingested by then counts as failed.
+int ingest_files_uring(FileList *files, DirIngest *ingest) {
+  static const int ops[] = {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE};
+  Uring ring;
+  IngestSlot slots[DIR_INGEST_SLOTS];
+  size_t next = 0;
+  int inFlight = 0, draining = 0, stuck = 0;
+
+  if (!uring_init(&ring, DIR_INGEST_SLOTS)) {
+    return 0;
+  }
+  if (!uring_supports(&ring, ops, sizeof(ops) / sizeof(ops[0]))) {
+    uring_free(&ring);
+    return 0;
+  }
+
+  memset(slots, 0, sizeof(slots));
+  for (int i = 0; i < DIR_INGEST_SLOTS; i++) {
+    slots[i].capacity = DIR_INGEST_BUFFER;
+    if (!(slots[i].buffer = malloc(slots[i].capacity))) {
+      for (int j = 0; j < i; j++) {
+        free(slots[j].buffer);
+      }
+      uring_free(&ring);
+      return 0;
+    }
+  }
+
+  while ((next < files->count && !draining) || inFlight > 0) {
+    for (int i = 0; i < DIR_INGEST_SLOTS && next < files->count && !draining; i++) {
+      if (slots[i].state != SLOT_FREE) {
+        continue;
+      }
+      struct io_uring_sqe *sqe = uring_sqe(&ring, i);
+      sqe->opcode = IORING_OP_OPENAT;
+      sqe->fd = AT_FDCWD;
+      sqe->addr = (uint64_t) (uintptr_t) files->names[next++];
+      sqe->open_flags = O_RDONLY;
+      slots[i].state = SLOT_OPENING;
+      slots[i].size = 0;
+      inFlight++;
+    }
+
+    if (!uring_submit_and_wait(&ring)) {
+      // one more failure while draining and the kernel may still own the buffers
+      if (draining) {
+        stuck = 1;
+        break;
+      }
+      draining = 1;
+      continue;
+    }
+
+    unsigned head = *ring.cqHead;
+    unsigned tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+      struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cqMask];
+      int index = cqe->user_data;
+      IngestSlot *slot = &slots[index];
+
+      switch (slot->state) {
+        case SLOT_OPENING:
+          if (cqe->res < 0) {
+            ingest->failed++;
+            slot->state = SLOT_FREE;
+            inFlight--;
+          } else if (draining) {
+            close(cqe->res);
+            ingest->failed++;
+            slot->state = SLOT_FREE;
+            inFlight--;
+          } else {
+            slot->fd = cqe->res;
+            if (!queue_read(&ring, slot, index)) {
+              ingest->failed++;
+              queue_close(&ring, slot, index);
+            }
+          }
+          break;
+        case SLOT_READING:
+          if (cqe->res > 0 && !draining) {
+            slot->size += cqe->res;
+            if (queue_read(&ring, slot, index)) {
+              break;
+            }
+            ingest->failed++;
+          } else if (cqe->res == 0 && !draining) {
+            ingest->files++;
+            ingest->bytes += slot->size;
+            ingest_game_text(ingest, NULL, slot->buffer, slot->size);
+          } else {
+            ingest->failed++;
+          }
+          if (draining) {
+            close(slot->fd);
+            slot->state = SLOT_FREE;
+            inFlight--;
+          } else {
+            queue_close(&ring, slot, index);
+          }
+          break;
+        case SLOT_CLOSING:
+          slot->state = SLOT_FREE;
+          inFlight--;
+          break;
+        default:
+          break;
+      }
+    }
+
+    __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+  }
+
+  // files never opened because the ring broke
+  ingest->failed += files->count - next;
+
+  for (int i = 0; i < DIR_INGEST_SLOTS; i++) {
+    if (stuck && slots[i].state != SLOT_FREE) {
+      // a request may still write into this buffer, leaking it is the safe choice
+      if (slots[i].state == SLOT_READING) {
+        close(slots[i].fd);
+      }
+      ingest->failed++;
+      continue;
+    }
+    free(slots[i].buffer);
+  }
+  uring_free(&ring);
+  return 1;
+}
+#else
+int ingest_files_uring(FileList *files, DirIngest *ingest) {
+  return 0;
+}
+#endif
+
+typedef struct {
+  FileList *files;
+  DirIngest *ingest;
+  _Atomic size_t next;
+} DirIngestPool;
+
+void *dir_ingest_worker(void *arg) {
+  DirIngestPool *pool = arg;
+  DirIngest local;
+  size_t capacity = DIR_INGEST_BUFFER;
+  char *buffer = malloc(capacity);
+  size_t i;
+
+  memset(&local, 0, sizeof(local));
+  local.archive = pool->ingest->archive;
+
+  while (buffer && (i = atomic_fetch_add(&pool->next, 1)) < pool->files->count) {
+    int fd = open(pool->files->names[i], O_RDONLY);
+    size_t size = 0;
+    ssize_t got = 0;
+
+    if (fd < 0) {
+      local.failed++;
+      continue;
+    }
+
+    while ((got = read(fd, buffer + size, capacity - size)) > 0) {
+      size += got;
+      if (size == capacity) {
+        char *grown = realloc(buffer, capacity * 2);
+        if (!grown) {
+          got = -1;
+          break;
+        }
+        buffer = grown;
+        capacity *= 2;
+      }
+    }
+    close(fd);
+
+    if (got < 0) {
+      local.failed++;
+      continue;
+    }
+
+    local.files++;
+    local.bytes += size;
+    // the archive is the only shared state
+    ingest_game_text(&local, &pool->ingest->archiveLock, buffer, size);
+  }
+
+  pthread_mutex_lock(&pool->ingest->archiveLock);
+  pool->ingest->files += local.files;
+  pool->ingest->games += local.games;
+  pool->ingest->illegal += local.illegal;
+  pool->ingest->failed += local.failed;
+  pool->ingest->bytes += local.bytes;
+  pthread_mutex_unlock(&pool->ingest->archiveLock);
+
+  free(local.moves);
+  free(buffer);
+  return NULL;
+}
+
+void ingest_files_threads(FileList *files, DirIngest *ingest, int threads) {
+  DirIngestPool pool;
+  pthread_t *ids = malloc(threads * sizeof(pthread_t));
+  int started = 0;
+
+  pool.files = files;
+  pool.ingest = ingest;
+  atomic_init(&pool.next, 0);
+
+  while (ids && started < threads && pthread_create(&ids[started], NULL, dir_ingest_worker, &pool) == 0) {
+    started++;
+  }
+  // the files nobody picked up are read here
+  if (started < threads) {
+    dir_ingest_worker(&pool);
+  }
+  for (int t = 0; t < started; t++) {
+    pthread_join(ids[t], NULL);
+  }
+
+  free(ids);
+}
+
+// lw10 ingest-dir <dir> <archive> [threads [N]]: one game per file, read with io_uring
+// when the kernel allows it, otherwise (or when asked for threads) with a thread pool
+int command_ingest_dir(int argc, char **argv) {
+  FileList files;
+  DirIngest ingest;
+  const char *mode = "io_uring";
+
+  if (argc < 4) {
+    fprintf(stderr, "usage: %s ingest-dir <dir> <archive> [threads [N]]\n", argv[0]);
+    return 2;
+  }
+
+  if (!list_directory(argv[2], &files)) {
+    fprintf(stderr, "Unable to read directory %s (or not enough memory to list it)\n", argv[2]);
+    return 1;
+  }
+
+  memset(&ingest, 0, sizeof(ingest));
+  pthread_mutex_init(&ingest.archiveLock, NULL);
+  ingest.archive = archive_open(argv[3], 1);
+  if (!ingest.archive) {
+    fprintf(stderr, "Unable to open archive %s\n", argv[3]);
+    free_file_list(&files);
+    return 1;
+  }
+
+  double start = now_seconds();
+  int forceThreads = argc > 4 && strcmp(argv[4], "threads") == 0;
+
+  if (forceThreads || !ingest_files_uring(&files, &ingest)) {
+    int threads = argc > 5 ? atoi(argv[5]) : sysconf(_SC_NPROCESSORS_ONLN);
+    mode = "thread pool";
+    ingest_files_threads(&files, &ingest, threads > 0 ? threads : 1);
+  }
+
+  int closed = archive_close(ingest.archive);
+  double elapsed = now_seconds() - start;
+
+  printf("%llu files (%.1f MB) via %s in %.3f s, %.0f files/s: %llu games archived, %llu illegal, %llu failed\n",
+         (unsigned long long) ingest.files, ingest.bytes / (1024.0 * 1024.0), mode, elapsed,
+         elapsed > 0 ? ingest.files / elapsed : 0, (unsigned long long) ingest.games,
+         (unsigned long long) ingest.illegal, (unsigned long long) ingest.failed);
+
+  pthread_mutex_destroy(&ingest.archiveLock);
+  free(ingest.moves);
+  free_file_list(&files);
+  return !closed || ingest.failed;
+}
+
+// lw10 positions <archive> [megabytes]: validates the archive through the
+// position -> legal moves cache and reports how often positions repeat
+int command_positions(int argc, char **argv) {
+  MappedArchive ar;
+  ArchiveEntry entry;
+  LegalMoveCache cache;
+  GameState state;
+  MoveStatus status;
+  uint64_t plies = 0, illegal = 0;
+
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s positions <archive> [megabytes]\n", argv[0]);
+    return 2;
+  }
+
+  uint64_t megabytes = 64;
+  if (argc > 3 && !parse_unsigned(argv[3], 10, &megabytes)) {
+    fprintf(stderr, "usage: %s positions <archive> [megabytes]\n", argv[0]);
+    return 2;
+  }
+
+  if (!legal_cache_init(&cache, megabytes > SIZE_MAX ? SIZE_MAX : megabytes)) {
+    fprintf(stderr, "Not enough memory for the cache\n");
+    return 1;
+  }
+
+  if (!archive_map(argv[2], &ar)) {
+    fprintf(stderr, "Unable to open archive %s\n", argv[2]);
+    legal_cache_free(&cache);
+    return 1;
+  }
+
+  double start = now_seconds();
+
+  for (uint64_t k = 0; k < ar.gameCount; k++) {
+    const PackedMove *packed = mapped_game(&ar, k, &entry);
+    if (!packed) {
+      continue;
+    }
+
+    initializeBoard(&state);
+    uint32_t played = replay_with_legal_cache(&cache, &state, packed, entry.plyCount, &status);
+    if (played < entry.plyCount) {
+      illegal++;
+    }
+    plies += played;
+  }
+
+  double elapsed = now_seconds() - start;
+  uint64_t lookups = cache.hits + cache.misses;
+
+  printf("%llu games, %llu plies, %llu illegal in %.3f s\n", (unsigned long long) ar.gameCount,
+         (unsigned long long) plies, (unsigned long long) illegal, elapsed);
+  printf("Legal move cache: %llu positions, %llu hits, %llu misses (%.1f%% hit rate), %llu evictions, %llu uncacheable\n",
+         (unsigned long long) (cache.bucketMask + 1) * LEGAL_CACHE_WAYS,
+         (unsigned long long) cache.hits, (unsigned long long) cache.misses,
+         lookups ? 100.0 * cache.hits / lookups : 0, (unsigned long long) cache.evictions,
+         (unsigned long long) cache.uncacheable);
+
+  archive_unmap(&ar);
+  legal_cache_free(&cache);
+  return illegal != 0;
+}
+
+typedef struct {
+  LegalMoveCache cache;
+  Archive *archive;
+  uint64_t games, plies, rejected, unsupported, failed;
+  uint64_t firstRejected; // 1-based game number, 0 if none
+  size_t firstRejectedPos;
+} PgnImport;
+
+long import_pgn_buffer(const char *data, size_t size, void *arg) {
+  PgnImport *import = arg;
+  size_t pos = 0;
+  long plies, capacity = pgn_moves_capacity(size);
+  int read;
+  PackedMove *packed = malloc(capacity * sizeof(PackedMove));
+
+  if (!packed) {
+    return -1;
+  }
+
+  while ((read = pgn_next_game(data, size, &pos, &import->cache, packed, capacity, &plies))) {
+    if (read < 0) {
+      import->rejected++;
+      import->unsupported += read == -2;
+      if (!import->firstRejected) {
+        import->firstRejected = import->games + import->rejected;
+        import->firstRejectedPos = pos;
+      }
+      pgn_skip_game(data, size, &pos);
+      continue;
+    }
+
+    import->games++;
+    import->plies += plies;
+    if (import->archive && !archive_append_packed(import->archive, packed, plies, 1)) {
+      import->failed++;
+    }
+  }
+
+  free(packed);
+  return 0;
+}
+
+// lw10 pgn <file.pgn> [archive]: reads every game of a PGN file, resolving the SAN moves
+// through the legal move cache, and reports the speed; with an archive the games are added to it
+int command_pgn(int argc, char **argv) {
+  PgnImport import;
+
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s pgn <file.pgn> [archive]\n", argv[0]);
+    return 2;
+  }
+
+  memset(&import, 0, sizeof(import));
+  if (!legal_cache_init(&import.cache, 64)) {
+    fprintf(stderr, "Not enough memory for the cache\n");
+    return 1;
+  }
+
+  if (argc > 3 && !(import.archive = archive_open(argv[3], 1))) {
+    fprintf(stderr, "Unable to open archive %s\n", argv[3]);
+    legal_cache_free(&import.cache);
+    return 1;
+  }
+
+  double start = now_seconds();
+  long result = with_file_contents(argv[2], import_pgn_buffer, &import);
+  int closed = !import.archive || archive_close(import.archive);
+  double elapsed = now_seconds() - start;
+
+  legal_cache_free(&import.cache);
+
+  if (result < 0) {
+    fprintf(stderr, "Unable to read %s\n", argv[2]);
+    return 1;
+  }
+
+  printf("%llu games, %llu plies in %.3f s: %.0f games/s, %.0f plies/s\n",
+         (unsigned long long) import.games, (unsigned long long) import.plies, elapsed,
+         elapsed > 0 ? import.games / elapsed : 0, elapsed > 0 ? import.plies / elapsed : 0);
+  if (import.rejected) {
+    printf("%llu games rejected, the first is game %llu (rejected at byte %zu)\n",
+           (unsigned long long) import.rejected, (unsigned long long) import.firstRejected,
+           import.firstRejectedPos);
+  }
+  if (import.unsupported) {
+    printf("%llu of them castle or start from another position, which isn't supported\n",
+           (unsigned long long) import.unsupported);
+  }
+  if (import.failed || !closed) {
+    fprintf(stderr, "Unable to write the archive\n");
+    return 1;
+  }
+
+  return import.rejected != 0;
+}
+
+// lw10 export <archive> <out.pgn>: writes every game of the archive as PGN
+int command_export(int argc, char **argv) {
+  MappedArchive ar;
+  ArchiveEntry entry;
+  OutputBuffer out;
+  uint64_t games = 0, plies = 0, truncated = 0;
+
+  if (argc < 4) {
+    fprintf(stderr, "usage: %s export <archive> <out.pgn>\n", argv[0]);
+    return 2;
+  }
+
+  if (!archive_map(argv[2], &ar)) {
+    fprintf(stderr, "Unable to open archive %s\n", argv[2]);
+    return 1;
+  }
+
+  FILE *fp = fopen(argv[3], "wb");
+  if (!fp) {
+    fprintf(stderr, "Unable to write %s\n", argv[3]);
+    archive_unmap(&ar);
+    return 1;
+  }
+
+  if (!output_init(&out, fp)) {
+    fprintf(stderr, "Not enough memory for the output buffer\n");
+    fclose(fp);
+    archive_unmap(&ar);
+    return 1;
+  }
+
+  double start = now_seconds();
+
+  for (uint64_t k = 0; k < ar.gameCount && !out.failed; k++) {
+    const PackedMove *packed = mapped_game(&ar, k, &entry);
+    if (!packed) {
+      continue;
+    }
+
+    long written = write_pgn_game(&out, packed, entry.plyCount, k + 1);
+    if (written < 0) {
+      break;
+    }
+
+    games++;
+    plies += written;
+    truncated += written < entry.plyCount;
+  }
+
+  int ok = output_free(&out);
+  long bytes = ftell(fp);
+  ok = fclose(fp) == 0 && ok;
+  double elapsed = now_seconds() - start;
+
+  printf("%llu games, %llu plies, %.1f MB in %.3f s: %.0f games/s\n", (unsigned long long) games,
+         (unsigned long long) plies, bytes / (1024.0 * 1024.0), elapsed, elapsed > 0 ? games / elapsed : 0);
+  if (truncated) {
+    printf("%llu games have an illegal move, they were exported up to it\n", (unsigned long long) truncated);
+  }
+
+  archive_unmap(&ar);
+
+  if (!ok) {
+    fprintf(stderr, "Unable to write %s\n", argv[3]);
+    return 1;
+  }
+
+  return truncated != 0;
+}
+
+// lw10 dump <archive> [game]: prints the board after every ply of one game, or of all
+// of them, rendered into one output buffer; the speed is reported on stderr
+int command_dump(int argc, char **argv) {
+  MappedArchive ar;
+  ArchiveEntry entry;
+  OutputBuffer out;
+  GameState state;
+  Move move;
+  uint64_t frames = 0, game = 0;
+
+  if (argc < 3 || (argc > 3 && !parse_unsigned(argv[3], 10, &game))) {
+    fprintf(stderr, "usage: %s dump <archive> [game]\n", argv[0]);
+    return 2;
+  }
+
+  if (!archive_map(argv[2], &ar)) {
+    fprintf(stderr, "Unable to open archive %s\n", argv[2]);
+    return 1;
+  }
+
+  uint64_t first = 0, last = ar.gameCount;
+  if (argc > 3) {
+    first = game - 1;
+    last = game;
+    if (game == 0 || game > ar.gameCount) {
+      fprintf(stderr, "There's no game %s in the archive (%llu games)\n", argv[3], (unsigned long long) ar.gameCount);
+      archive_unmap(&ar);
+      return 1;
+    }
+  }
+
+  if (!output_init(&out, stdout)) {
+    fprintf(stderr, "Not enough memory for the output buffer\n");
+    archive_unmap(&ar);
+    return 1;
+  }
+
+  double start = now_seconds();
+
+  for (uint64_t k = first; k < last && !out.failed; k++) {
+    const PackedMove *packed = mapped_game(&ar, k, &entry);
+    if (!packed) {
+      continue;
+    }
+
+    initializeBoard(&state);
+    for (uint32_t i = 0; i <= entry.plyCount; i++) {
+      char *p = output_reserve(&out, 64 + BOARD_TEXT_BYTES);
+      if (!p) {
+        break;
+      }
+
+      size_t len = sprintf(p, "Game %llu, ply %u\n", (unsigned long long) k + 1, i);
+      out.used += len + render_board(&state, p + len, 0);
+      frames++;
+
+      if (i == entry.plyCount) {
+        break;
+      }
+      unpack_move(packed[i], &move);
+      if (playMove(&state, &move) != MOVE_OK) {
+        break;
+      }
+    }
+  }
+
+  int ok = output_free(&out);
+  double elapsed = now_seconds() - start;
+
+  fprintf(stderr, "%llu boards in %.3f s, %.0f boards/s\n", (unsigned long long) frames, elapsed,
+          elapsed > 0 ? frames / elapsed : 0);
+
+  archive_unmap(&ar);
+  return !ok;
+}
+
+#define SQUARE_PIXELS 32
+#define IMAGE_PIXELS (8 * SQUARE_PIXELS)
+#define GLYPH_SIZE 16
+#define PIXEL_BYTES 4 // RGBA, the alpha of the frame itself is unused
+#define IMAGE_ROW_BYTES (IMAGE_PIXELS * PIXEL_BYTES)
+#define PNG_EXT ".png"
+#define PPM_EXT ".ppm"
+// deflate stored blocks hold at most 65535 bytes
+#define PNG_BLOCK 65535
+
+// Piece silhouettes, scaled up to SQUARE_PIXELS when the sprites are built
+const char *PIECE_GLYPHS[6] = {
+  // pawn
+  "................"
+  "................"
+  "................"
+  "................"
+  ".......##......."
+  "......####......"
+  "......####......"
+  ".......##......."
+  "......####......"
+  ".......##......."
+  "......####......"
+  ".....######....."
+  "....########...."
+  "....########...."
+  "................"
+  "................",
+  // rook
+  "................"
+  "................"
+  "................"
+  "....##.##.##...."
+  "....########...."
+  ".....######....."
+  ".....######....."
+  ".....######....."
+  ".....######....."
+  ".....######....."
+  ".....######....."
+  "....########...."
+  "...##########..."
+  "...##########..."
+  "................"
+  "................",
+  // knight
+  "................"
+  "................"
+  "................"
+  ".......##......."
+  "......#####....."
+  ".....#######...."
+  "....########...."
+  "...####.#####..."
+  "...###..#####..."
+  ".......######..."
+  "......######...."
+  ".....#######...."
+  "....########...."
+  "...##########..."
+  "................"
+  "................",
+  // bishop
+  "................"
+  "................"
+  ".......##......."
+  "......####......"
+  ".....###.##....."
+  ".....##.###....."
+  ".....######....."
+  "......####......"
+  ".......##......."
+  "......####......"
+  ".....######....."
+  "....########...."
+  "...##########..."
+  "...##########..."
+  "................"
+  "................",
+  // queen
+  "................"
+  "................"
+  "..#...#..#...#.."
+  "..##..#..#..##.."
+  "..###.####.###.."
+  "...##########..."
+  "...##########..."
+  "....########...."
+  ".....######....."
+  ".....######....."
+  ".....######....."
+  "....########...."
+  "...##########..."
+  "...##########..."
+  "................"
+  "................",
+  // king
+  "................"
+  ".......##......."
+  "......####......"
+  ".......##......."
+  ".....######....."
+  "....########...."
+  "...##########..."
+  "...##########..."
+  "....########...."
+  ".....######....."
+  ".....######....."
+  ".....######....."
+  "....########...."
+  "...##########..."
+  "...##########..."
+  "................"
+};
+
+const unsigned char LIGHT_SQUARE[3] = {240, 217, 181};
+const unsigned char DARK_SQUARE[3] = {181, 136, 99};
+const unsigned char PIECE_FILL[2][3] = {{250, 250, 245}, {45, 45, 50}};
+const unsigned char PIECE_OUTLINE[2][3] = {{20, 20, 20}, {210, 210, 210}};
+
+// RGBA sprites by color (white, black) and type, straight alpha
+unsigned char SPRITES[2][7][SQUARE_PIXELS * SQUARE_PIXELS * PIXEL_BYTES] __attribute__((aligned(16)));
+pthread_once_t spritesOnce = PTHREAD_ONCE_INIT;
+
+// Whether a sprite pixel is inside the piece, the glyph scaled up to SQUARE_PIXELS
+int sprite_inside(const char *glyph, int y, int x) {
+  int scale = SQUARE_PIXELS / GLYPH_SIZE;
+
+  return y >= 0 && y < SQUARE_PIXELS && x >= 0 && x < SQUARE_PIXELS &&
+         glyph[y / scale * GLYPH_SIZE + x / scale] == '#';
+}
+
+// Pixels inside the piece are filled, with a one pixel outline where they touch the
+// outside; the outside pixels next to the piece get a faint halo so it reads on both
+// square colors
+void init_sprites(void) {
+  for (int color = 0; color < 2; color++) {
+    for (int type = PAWN; type <= KING; type++) {
+      const char *glyph = PIECE_GLYPHS[type - PAWN];
+      unsigned char *sprite = SPRITES[color][type];
+
+      for (int y = 0; y < SQUARE_PIXELS; y++) {
+        for (int x = 0; x < SQUARE_PIXELS; x++) {
+          unsigned char *pixel = sprite + (y * SQUARE_PIXELS + x) * PIXEL_BYTES;
+          const unsigned char *rgb = PIECE_OUTLINE[color];
+          int neighbours = 0, alpha = 0;
+
+          for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+              neighbours += sprite_inside(glyph, y + dy, x + dx);
+            }
+          }
+
+          if (sprite_inside(glyph, y, x)) {
+            alpha = 255;
+            if (neighbours == 9) {
+              rgb = PIECE_FILL[color];
+            }
+          } else if (neighbours) {
+            alpha = 96;
+          }
+
+          pixel[0] = rgb[0];
+          pixel[1] = rgb[1];
+          pixel[2] = rgb[2];
+          pixel[3] = alpha;
+        }
+      }
+    }
+  }
+}
+
+// Frame buffer reused for every image, with the pieces it currently shows so that
+// consecutive plies only repaint the squares that changed
+typedef struct {
+  unsigned char *pixels;
+  Piece drawn[8][8];
+  int valid;
+  unsigned char *encoded;
+  size_t encodedCapacity;
+} FrameBuffer;
+
+int frame_init(FrameBuffer *frame) {
+  // a PNG is the largest encoding: filter bytes, stored block headers and the chunks around them
+  size_t raw = (size_t) IMAGE_PIXELS * (IMAGE_PIXELS * 3 + 1);
+
+  frame->valid = 0;
+  frame->encodedCapacity = raw + (raw / PNG_BLOCK + 1) * 5 + 128;
+  frame->pixels = aligned_alloc(64, (size_t) IMAGE_PIXELS * IMAGE_ROW_BYTES);
+  frame->encoded = malloc(frame->encodedCapacity);
+
+  if (!frame->pixels || !frame->encoded) {
+    free(frame->pixels);
+    free(frame->encoded);
+    return 0;
+  }
+
+  pthread_once(&spritesOnce, init_sprites);
+  return 1;
+}
+
+void frame_free(FrameBuffer *frame) {
+  free(frame->pixels);
+  free(frame->encoded);
+}
+
+// Alpha blends a sprite over a square: out = (src * a + dst * (256 - a)) >> 8, with
+// a = 255 taken as 256 so opaque pixels are copied exactly
+void blit_sprite(unsigned char *dst, const unsigned char *sprite) {
+  for (int y = 0; y < SQUARE_PIXELS; y++, dst += IMAGE_ROW_BYTES, sprite += SQUARE_PIXELS * PIXEL_BYTES) {
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128(), full = _mm_set1_epi16(256);
+
+    for (int x = 0; x < SQUARE_PIXELS * PIXEL_BYTES; x += 16) {
+      __m128i src = _mm_load_si128((const __m128i *) (sprite + x));
+      __m128i back = _mm_load_si128((const __m128i *) (dst + x));
+      __m128i halves[2];
+
+      for (int h = 0; h < 2; h++) {
+        __m128i s = h ? _mm_unpackhi_epi8(src, zero) : _mm_unpacklo_epi8(src, zero);
+        __m128i d = h ? _mm_unpackhi_epi8(back, zero) : _mm_unpacklo_epi8(back, zero);
+        // the alpha of each of the two pixels in all four of its lanes
+        __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xff), 0xff);
+        a = _mm_add_epi16(a, _mm_srli_epi16(a, 7));
+        halves[h] = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(s, a),
+                                                 _mm_mullo_epi16(d, _mm_sub_epi16(full, a))), 8);
+      }
+
+      _mm_store_si128((__m128i *) (dst + x), _mm_packus_epi16(halves[0], halves[1]));
+    }
+#else
+    for (int x = 0; x < SQUARE_PIXELS * PIXEL_BYTES; x += PIXEL_BYTES) {
+      int a = sprite[x + 3] + (sprite[x + 3] >> 7);
+      for (int c = 0; c < PIXEL_BYTES; c++) {
+        dst[x + c] = (sprite[x + c] * a + dst[x + c] * (256 - a)) >> 8;
+      }
+    }
+#endif
+  }
+}
+
+void draw_square(FrameBuffer *frame, int rank, int file, Piece piece) {
+  const unsigned char *rgb = (rank + file) % 2 ? DARK_SQUARE : LIGHT_SQUARE;
+  unsigned char *square = frame->pixels + (size_t) rank * SQUARE_PIXELS * IMAGE_ROW_BYTES +
+                          file * SQUARE_PIXELS * PIXEL_BYTES;
+
+  for (int x = 0; x < SQUARE_PIXELS * PIXEL_BYTES; x += PIXEL_BYTES) {
+    square[x] = rgb[0];
+    square[x + 1] = rgb[1];
+    square[x + 2] = rgb[2];
+    square[x + 3] = 255;
+  }
+  for (int y = 1; y < SQUARE_PIXELS; y++) {
+    memcpy(square + y * IMAGE_ROW_BYTES, square, SQUARE_PIXELS * PIXEL_BYTES);
+  }
+
+  if (piece.type != EMPTY) {
+    blit_sprite(square, SPRITES[piece.color == BLACK][piece.type]);
+  }
+}
+
+// Paints the position, only the squares that differ from the last one when there is one
+void render_image(FrameBuffer *frame, GameState *state) {
+  for (int i = 0; i < 8; i++) {
+    for (int j = 0; j < 8; j++) {
+      Piece piece = state->board[i][j], old = frame->drawn[i][j];
+
+      if (frame->valid && piece.type == old.type && piece.color == old.color) {
+        continue;
+      }
+      draw_square(frame, i, j, piece);
+      frame->drawn[i][j] = piece;
+    }
+  }
+
+  frame->valid = 1;
+}
+
+// RGB rows of the frame, each after a filter byte when filter is set (PNG)
+unsigned char *frame_rgb_rows(FrameBuffer *frame, unsigned char *out, int filter) {
+  const unsigned char *pixel = frame->pixels;
+
+  for (int y = 0; y < IMAGE_PIXELS; y++) {
+    if (filter) {
+      *out++ = 0;
+    }
+    for (int x = 0; x < IMAGE_PIXELS; x++, pixel += PIXEL_BYTES) {
+      *out++ = pixel[0];
+      *out++ = pixel[1];
+      *out++ = pixel[2];
+    }
+  }
+
+  return out;
+}
+
+size_t encode_ppm(FrameBuffer *frame) {
+  unsigned char *out = frame->encoded;
+
+  out += sprintf((char *) out, "P6\n%d %d\n255\n", IMAGE_PIXELS, IMAGE_PIXELS);
+  return frame_rgb_rows(frame, out, 0) - frame->encoded;
+}
+
+void put_be32(unsigned char *out, uint32_t value) {
+  out[0] = value >> 24;
+  out[1] = value >> 16;
+  out[2] = value >> 8;
+  out[3] = value;
+}
+
+uint32_t adler32(const unsigned char *data, size_t size) {
+  uint32_t a = 1, b = 0;
+
+  while (size) {
+    // the sums can't overflow in 5552 steps
+    size_t n = size < 5552 ? size : 5552;
+    size -= n;
+    while (n--) {
+      a += *data++;
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+
+  return b << 16 | a;
+}
+
+// Finishes a chunk whose type and data are already at chunk + 4; returns its full size
+size_t png_chunk(unsigned char *chunk, size_t length) {
+  put_be32(chunk, length);
+  put_be32(chunk + 8 + length, crc32(chunk + 4, length + 4));
+  return length + 12;
+}
+
+// PNG with the image data in stored (uncompressed) deflate blocks: no compressor to
+// bundle, and the size is the same for every frame
+size_t encode_png(FrameBuffer *frame) {
+  static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  size_t raw = (size_t) IMAGE_PIXELS * (IMAGE_PIXELS * 3 + 1);
+  size_t blocks = (raw + PNG_BLOCK - 1) / PNG_BLOCK;
+  unsigned char *out = frame->encoded;
+
+  memcpy(out, signature, sizeof(signature));
+  out += sizeof(signature);
+
+  memcpy(out + 4, "IHDR", 4);
+  put_be32(out + 8, IMAGE_PIXELS);
+  put_be32(out + 12, IMAGE_PIXELS);
+  // 8 bit RGB, deflate, no filter method, no interlacing
+  memcpy(out + 16, "\x08\x02\x00\x00\x00", 5);
+  out += png_chunk(out, 13);
+
+  unsigned char *idat = out;
+  unsigned char *data = idat + 8;
+  memcpy(idat + 4, "IDAT", 4);
+  // zlib header: deflate with a 32K window, no dictionary
+  data[0] = 0x78;
+  data[1] = 0x01;
+
+  // the rows are written past room for all the block headers, then each block is moved
+  // down behind its header; a block never lands on the data of the ones after it
+  unsigned char *rows = data + 2 + blocks * 5;
+  frame_rgb_rows(frame, rows, 1);
+  uint32_t checksum = adler32(rows, raw);
+
+  for (size_t b = 0; b < blocks; b++) {
+    size_t offset = b * PNG_BLOCK, len = raw - offset < PNG_BLOCK ? raw - offset : PNG_BLOCK;
+    unsigned char *header = data + 2 + offset + b * 5;
+
+    memmove(header + 5, rows + offset, len);
+    header[0] = b + 1 == blocks;
+    header[1] = len & 0xff;
+    header[2] = len >> 8;
+    header[3] = ~len & 0xff;
+    header[4] = (~len >> 8) & 0xff;
+  }
+
+  put_be32(data + 2 + raw + blocks * 5, checksum);
+  out += png_chunk(idat, 2 + raw + blocks * 5 + 4);
+
+  memcpy(out + 4, "IEND", 4);
+  out += png_chunk(out, 0);
+
+  return out - frame->encoded;
+}
+
+// Writes the frame as PNG or PPM depending on the file extension
+int write_image(FrameBuffer *frame, const char *filename) {
+  size_t size = has_extension(filename, PNG_EXT) ? encode_png(frame) : encode_ppm(frame);
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if (fd < 0) {
+    return 0;
+  }
+
+  int ok = write_all(fd, (const char *) frame->encoded, size);
+  return close(fd) == 0 && ok;
+}
+
+// lw10 image <archive> <game> <file.png|file.ppm> [ply]: draws the board after the ply,
+// or after every ply into file-000.png, file-001.png, ... and reports frames per second
+int command_image(int argc, char **argv) {
+  MappedArchive ar;
+  ArchiveEntry entry;
+  FrameBuffer frame;
+  GameState state;
+  Move move;
+  double renderTime = 0;
+  uint32_t frames = 0;
+  uint64_t k, ply = UINT64_MAX;
+  char filename[4096];
+
+  // the frame number and extension have to fit behind the name
+  if (argc < 5 || !parse_unsigned(argv[3], 10, &k) || (argc > 5 && !parse_unsigned(argv[5], 10, &ply)) ||
+      strlen(argv[4]) > sizeof(filename) - 16) {
+    fprintf(stderr, "usage: %s image <archive> <game> <file.png|file.ppm> [ply]\n", argv[0]);
+    return 2;
+  }
+
+  if (!archive_map(argv[2], &ar)) {
+    fprintf(stderr, "Unable to open archive %s\n", argv[2]);
+    return 1;
+  }
+
+  const PackedMove *packed = k ? mapped_game(&ar, k - 1, &entry) : NULL;
+
+  if (!packed) {
+    fprintf(stderr, "There's no game %s in the archive (%llu games)\n", argv[3], (unsigned long long) ar.gameCount);
+    archive_unmap(&ar);
+    return 1;
+  }
+
+  if (!frame_init(&frame)) {
+    fprintf(stderr, "Not enough memory for the frame buffer\n");
+    archive_unmap(&ar);
+    return 1;
+  }
+
+  // a ply past the end draws the final position
+  int single = argc > 5;
+  uint32_t last = ply < entry.plyCount ? ply : entry.plyCount;
+
+  // file-NNN goes in front of the extension
+  const char *dot = strrchr(argv[4], '.');
+  int stem = dot ? dot - argv[4] : (int) strlen(argv[4]);
+  int ok = 1;
+
+  double start = now_seconds();
+  initializeBoard(&state);
+
+  for (uint32_t i = 0; i <= last && ok; i++) {
+    if (!single || i == last) {
+      double before = now_seconds();
+      render_image(&frame, &state);
+      renderTime += now_seconds() - before;
+
+      if (single) {
+        snprintf(filename, sizeof(filename), "%s", argv[4]);
+      } else {
+        snprintf(filename, sizeof(filename), "%.*s-%03u%s", stem, argv[4], i, dot ? dot : "");
+      }
+      ok = write_image(&frame, filename);
+      frames++;
+    }
+
+    if (i < last) {
+      unpack_move(packed[i], &move);
+      if (playMove(&state, &move) != MOVE_OK) {
+        fprintf(stderr, "Move %u is illegal, stopping there\n", i + 1);
+        // a single image still shows the position before that move
+        last = single ? i-- : i;
+      }
+    }
+  }
+
+  double elapsed = now_seconds() - start;
+
+  if (!ok) {
+    fprintf(stderr, "Unable to write %s\n", filename);
+  }
+  printf("%u frames in %.3f s, %.0f frames/s (%.0f frames/s rendering only)\n", frames, elapsed,
+         elapsed > 0 ? frames / elapsed : 0, renderTime > 0 ? frames / renderTime : 0);
+
+  frame_free(&frame);
+  archive_unmap(&ar);
+  return !ok;
+}
+
+// Fixed seed of the benchmark corpus, so every run measures the same games
+#define BENCH_SEED 0x6c7731305f62656eULL
+#define BENCH_GAMES 100
+#define BENCH_MAX_PLIES 120
+#define BENCH_WARMUP 3
+#define BENCH_REPEATS 25
+#define BENCH_LOADS 16
+// bench-compare: runs taken the median of, and the slowdown in percent that fails
+#define BENCH_RUNS 5
+#define BENCH_MAX_RUNS 32
+#define BENCH_THRESHOLD 10.0
+
+// xorshift64*, good enough to pick moves and never zero for a nonzero seed
+uint64_t random_next(uint64_t *seed) {
+  *seed ^= *seed >> 12;
+  *seed ^= *seed << 25;
+  *seed ^= *seed >> 27;
+  return *seed * 0x2545f4914f6cdd1dULL;
+}
+
+// Picks one of the legal moves of the position uniformly; returns 0 if there is none
+int random_legal_move(GameState *state, uint64_t *seed, Move *move) {
+  LegalSet legal;
+  int count = 0;
+
+  generate_legal_set(state, &legal);
+  for (int i = 0; i < LEGAL_SET_PIECES; i++) {
+    count += __builtin_popcountll(legal.targets[i]);
+  }
+  if (!count) {
+    return 0;
+  }
+
+  int pick = random_next(seed) % count;
+  uint64_t from = legal.fromMask;
+
+  for (int entry = 0; from; entry++) {
+    int square = __builtin_ctzll(from);
+    uint64_t targets = legal.targets[entry];
+    from &= from - 1;
+
+    if (pick >= __builtin_popcountll(targets)) {
+      pick -= __builtin_popcountll(targets);
+      continue;
+    }
+    while (pick--) {
+      targets &= targets - 1;
+    }
+
+    int to = __builtin_ctzll(targets);
+    move->fromRank = square / 8;
+    move->fromFile = square % 8;
+    move->toRank = to / 8;
+    move->toFile = to % 8;
+    move->promotion = state->board[square / 8][square % 8].type == PAWN && (to / 8 == 0 || to / 8 == 7) ? QUEEN : EMPTY;
+    return 1;
+  }
+
+  return 0;
+}
+
+// Plays random legal moves from the initial position until maxPlies or no move is left
+long random_game(uint64_t *seed, Move *out, long maxPlies) {
+  GameState state;
+  long plies = 0;
+
+  initializeBoard(&state);
+  while (plies < maxPlies && random_legal_move(&state, seed, &out[plies])) {
+    playMove(&state, &out[plies++]);
+  }
+
+  return plies;
+}
+
+// Games the benchmarks run over, with the position before every ply and the moves as text
+typedef struct {
+  Move *moves;
+  long gameStart[BENCH_GAMES + 1];
+  long plies;
+  GameState *positions;
+  char (*text)[6];
+  Move *probes; // a pseudo-legal move from each position, often illegal
+  char textFile[32];
+  char binaryFile[32];
+  char pgnFile[32];
+} BenchCorpus;
+
+volatile long benchSink;
+
+long bench_parse_move(BenchCorpus *corpus) {
+  char move[6];
+  long sum = 0;
+
+  for (long i = 0; i < corpus->plies; i++) {
+    memcpy(move, corpus->text[i], sizeof(move));
+    sum += parseMove(move);
+  }
+
+  benchSink = sum;
+  return corpus->plies;
+}
+
+long bench_is_legal_move(BenchCorpus *corpus) {
+  long sum = 0;
+
+  for (long i = 0; i < corpus->plies; i++) {
+    sum += isLegalMove(&corpus->positions[i], &corpus->moves[i]);
+    sum += isLegalMove(&corpus->positions[i], &corpus->probes[i]);
+  }
+
+  benchSink = sum;
+  return corpus->plies * 2;
+}
+
+long bench_is_check(BenchCorpus *corpus) {
+  long sum = 0;
+
+  for (long i = 0; i < corpus->plies; i++) {
+    Move *move = &corpus->moves[i];
+    Piece piece = corpus->positions[i].board[move->fromRank][move->fromFile];
+    sum += isCheck(&corpus->positions[i], move, &piece);
+  }
+
+  benchSink = sum;
+  return corpus->plies;
+}
+
+// Whole games through makeMove, as the interactive replay plays them
+long bench_make_move(BenchCorpus *corpus) {
+  GameState state;
+  long sum = 0;
+
+  for (int g = 0; g < BENCH_GAMES; g++) {
+    initializeBoard(&state);
+    for (long i = corpus->gameStart[g]; i < corpus->gameStart[g + 1]; i++) {
+      sum += makeMove(&state, &corpus->moves[i]);
+    }
+  }
+
+  benchSink = sum;
+  return corpus->plies;
+}
+
+// replayGame without the display: every game checked from the initial position
+long bench_replay(BenchCorpus *corpus) {
+  long sum = 0;
+
+  for (int g = 0; g < BENCH_GAMES; g++) {
+    sum += validate_record(corpus->moves + corpus->gameStart[g], corpus->gameStart[g + 1] - corpus->gameStart[g]);
+  }
+
+  benchSink = sum;
+  return BENCH_GAMES;
+}
+
+// The loaders behind load_data, each reading its file BENCH_LOADS times
+long bench_load_text(BenchCorpus *corpus) {
+  Move *moves = NULL;
+
+  for (int i = 0; i < BENCH_LOADS; i++) {
+    benchSink = load_text_game(corpus->textFile, &moves);
+    free_memory(&moves);
+  }
+  return BENCH_LOADS;
+}
+
+long bench_load_binary(BenchCorpus *corpus) {
+  Move *moves = NULL;
+  int validated;
+
+  for (int i = 0; i < BENCH_LOADS; i++) {
+    FILE *fp = fopen(corpus->binaryFile, "rb");
+    if (fp) {
+      benchSink = load_binary_game(fp, &moves, &validated);
+      fclose(fp);
+    }
+    free_memory(&moves);
+  }
+  return BENCH_LOADS;
+}
+
+long bench_load_pgn(BenchCorpus *corpus) {
+  Move *moves = NULL;
+
+  for (int i = 0; i < BENCH_LOADS; i++) {
+    benchSink = load_pgn_game(corpus->pgnFile, &moves);
+    free_memory(&moves);
+  }
+  return BENCH_LOADS;
+}
+
+// Writes the corpus to a new temporary file with the given saver; the name goes to filename
+int bench_write_file(BenchCorpus *corpus, char *filename, int (*save)(FILE *, Move *, int)) {
+  strcpy(filename, "/tmp/lw10-bench-XXXXXX");
+  int fd = mkstemp(filename);
+  FILE *fp = fd >= 0 ? fdopen(fd, "wb") : NULL;
+
+  if (!fp) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    filename[0] = '\0';
+    return 0;
+  }
+
+  int ok = save(fp, corpus->moves, corpus->plies);
+  return fclose(fp) == 0 && ok;
+}
+
+void bench_corpus_free(BenchCorpus *corpus) {
+  const char *files[3] = {corpus->textFile, corpus->binaryFile, corpus->pgnFile};
+
+  for (int i = 0; i < 3; i++) {
+    if (files[i][0]) {
+      unlink(files[i]);
+    }
+  }
+  free(corpus->moves);
+  free(corpus->positions);
+  free(corpus->text);
+  free(corpus->probes);
+}
+
+// Random games from BENCH_SEED; a probe is the played piece sent to a random square of its pattern
+int bench_corpus_init(BenchCorpus *corpus) {
+  uint64_t seed = BENCH_SEED;
+  long capacity = (long) BENCH_GAMES * BENCH_MAX_PLIES;
+
+  memset(corpus, 0, sizeof(*corpus));
+  corpus->moves = malloc(capacity * sizeof(Move));
+  corpus->positions = malloc(capacity * sizeof(GameState));
+  corpus->text = malloc(capacity * sizeof(*corpus->text));
+  corpus->probes = malloc(capacity * sizeof(Move));
+
+  if (!corpus->moves || !corpus->positions || !corpus->text || !corpus->probes) {
+    return 0;
+  }
+
+  for (int g = 0; g < BENCH_GAMES; g++) {
+    GameState state;
+    long start = corpus->plies;
+
+    corpus->gameStart[g] = start;
+    corpus->plies += random_game(&seed, corpus->moves + start, BENCH_MAX_PLIES);
+
+    initializeBoard(&state);
+    for (long i = start; i < corpus->plies; i++) {
+      Move *move = &corpus->moves[i];
+      Piece piece = state.board[move->fromRank][move->fromFile];
+      uint64_t candidates = candidate_targets(piece.type, move->fromRank, move->fromFile);
+      int pick = random_next(&seed) % __builtin_popcountll(candidates);
+
+      while (pick--) {
+        candidates &= candidates - 1;
+      }
+      corpus->probes[i] = *move;
+      corpus->probes[i].toRank = __builtin_ctzll(candidates) / 8;
+      corpus->probes[i].toFile = __builtin_ctzll(candidates) % 8;
+
+      corpus->positions[i] = state;
+      unparse_move(move, corpus->text[i]);
+      playMove(&state, move);
+    }
+  }
+  corpus->gameStart[BENCH_GAMES] = corpus->plies;
+
+  return 1;
+}
+
+typedef struct {
+  const char *name;
+  long (*run)(BenchCorpus *);
+} Benchmark;
+
+const Benchmark BENCHMARKS[] = {
+  {"parseMove", bench_parse_move},
+  {"isLegalMove", bench_is_legal_move},
+  {"isCheck", bench_is_check},
+  {"makeMove", bench_make_move},
+  {"replayGame", bench_replay},
+  {"load_text", bench_load_text},
+  {"load_binary", bench_load_binary},
+  {"load_pgn", bench_load_pgn},
+};
+
+int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+typedef struct {
+  long ops;
+  double median;
+  double p99;
+  double min;
+} BenchResult;
+
+#define BENCH_COUNT (sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]))
+
+// Corpus plus the files of the loaders, which read its first game, a record of legal
+// moves, in each format
+int bench_setup(BenchCorpus *corpus) {
+  if (!bench_corpus_init(corpus)) {
+    fprintf(stderr, "Not enough memory for the benchmark corpus\n");
+    bench_corpus_free(corpus);
+    return 0;
+  }
+
+  long allPlies = corpus->plies;
+  corpus->plies = corpus->gameStart[1];
+  int files = bench_write_file(corpus, corpus->textFile, save_text_game) &&
+              bench_write_file(corpus, corpus->binaryFile, save_binary_game) &&
+              bench_write_file(corpus, corpus->pgnFile, save_pgn_game);
+  corpus->plies = allPlies;
+
+  if (!files) {
+    fprintf(stderr, "Unable to write the benchmark files to /tmp\n");
+    bench_corpus_free(corpus);
+    return 0;
+  }
+
+  return 1;
+}
+
+// Warms every benchmark up, then times it repeats times; returns 0 without memory
+int run_benchmarks(BenchCorpus *corpus, int repeats, BenchResult *results) {
+  double *samples = malloc(repeats * sizeof(double));
+
+  if (!samples) {
+    return 0;
+  }
+
+  for (size_t b = 0; b < BENCH_COUNT; b++) {
+    for (int i = 0; i < BENCH_WARMUP; i++) {
+      BENCHMARKS[b].run(corpus);
+    }
+
+    for (int i = 0; i < repeats; i++) {
+      double start = now_seconds();
+      results[b].ops = BENCHMARKS[b].run(corpus);
+      samples[i] = (now_seconds() - start) * 1e9 / results[b].ops;
+    }
+
+    qsort(samples, repeats, sizeof(double), compare_doubles);
+    int p99 = (int) (repeats * 0.99);
+
+    results[b].median = samples[repeats / 2];
+    results[b].p99 = samples[p99 < repeats ? p99 : repeats - 1];
+    results[b].min = samples[0];
+  }
+
+  free(samples);
+  return 1;
+}
+
+// lw10 bench [repeats]: times the core functions over a fixed random corpus and prints
+// the median, p99 and best ns/op of each as JSON
+int command_bench(int argc, char **argv) {
+  BenchCorpus corpus;
+  BenchResult results[BENCH_COUNT];
+  uint64_t repeats = BENCH_REPEATS;
+
+  if (argc > 2 && (!parse_unsigned(argv[2], 10, &repeats) || repeats < 1 || repeats > INT_MAX)) {
+    fprintf(stderr, "usage: %s bench [repeats]\n", argv[0]);
+    return 2;
+  }
+
+  if (!bench_setup(&corpus)) {
+    return 1;
+  }
+
+  if (!run_benchmarks(&corpus, repeats, results)) {
+    fprintf(stderr, "Not enough memory for the samples\n");
+    bench_corpus_free(&corpus);
+    return 1;
+  }
+
+  printf("{\n  \"corpus\": {\"seed\": %llu, \"games\": %d, \"plies\": %ld},\n  \"repeats\": %d,\n  \"benchmarks\": [\n",
+         (unsigned long long) BENCH_SEED, BENCH_GAMES, corpus.plies, (int) repeats);
+
+  for (size_t b = 0; b < BENCH_COUNT; b++) {
+    printf("    {\"name\": \"%s\", \"ops\": %ld, \"median_ns_per_op\": %.2f, \"p99_ns_per_op\": %.2f, \"min_ns_per_op\": %.2f}%s\n",
+           BENCHMARKS[b].name, results[b].ops, results[b].median, results[b].p99, results[b].min,
+           b + 1 < BENCH_COUNT ? "," : "");
+  }
+
+  printf("  ]\n}\n");
+
+  bench_corpus_free(&corpus);
+  return 0;
+}
+
+// Median ns/op of a benchmark in JSON written by lw10 bench, -1 if it isn't there
+double baseline_median(const char *json, const char *name) {
+  char key[64];
+  const char *entry;
+
+  snprintf(key, sizeof(key), "\"name\": \"%s\"", name);
+  if (!(entry = strstr(json, key))) {
+    return -1;
+  }
+
+  const char *value = strstr(entry, "\"median_ns_per_op\":");
+  const char *next = strstr(entry + 1, "\"name\":");
+  if (!value || (next && value > next)) {
+    return -1;
+  }
+
+  return strtod(value + strlen("\"median_ns_per_op\":"), NULL);
+}
+
+long read_whole_file(const char *data, size_t size, void *arg) {
+  char **copy = arg;
+
+  if (!(*copy = malloc(size + 1))) {
+    return -1;
+  }
+  memcpy(*copy, data, size);
+  (*copy)[size] = '\0';
+  return size;
+}
+
+// lw10 bench-compare <baseline.json> [threshold %] [runs]: runs the benchmarks several
+// times and compares the median of their medians with the baseline; fails when any of
+// them got slower by more than the threshold
+int command_bench_compare(int argc, char **argv) {
+  BenchCorpus corpus;
+  BenchResult results[BENCH_COUNT];
+  double runMedians[BENCH_COUNT][BENCH_MAX_RUNS];
+  char *baseline = NULL;
+  double threshold = BENCH_THRESHOLD;
+  uint64_t runs = BENCH_RUNS;
+  int regressions = 0;
+  char *end = NULL;
+
+  if (argc > 3) {
+    threshold = strtod(argv[3], &end);
+  }
+
+  // nan or a huge threshold would hide every regression
+  if (argc < 3 || (argc > 3 && (end == argv[3] || *end)) || !(threshold > 0 && threshold <= 1000) ||
+      (argc > 4 && (!parse_unsigned(argv[4], 10, &runs) || runs < 1 || runs > BENCH_MAX_RUNS))) {
+    fprintf(stderr, "usage: %s bench-compare <baseline.json> [threshold %%] [runs, up to %d]\n", argv[0], BENCH_MAX_RUNS);
+    return 2;
+  }
+
+  if (with_file_contents(argv[2], read_whole_file, &baseline) < 0) {
+    fprintf(stderr, "Unable to read %s\n", argv[2]);
+    return 1;
+  }
+
+  if (!bench_setup(&corpus)) {
+    free(baseline);
+    return 1;
+  }
+
+  for (int r = 0; r < runs; r++) {
+    if (!run_benchmarks(&corpus, BENCH_REPEATS, results)) {
+      fprintf(stderr, "Not enough memory for the samples\n");
+      bench_corpus_free(&corpus);
+      free(baseline);
+      return 1;
+    }
+    for (size_t b = 0; b < BENCH_COUNT; b++) {
+      runMedians[b][r] = results[b].median;
+    }
+  }
+
+  printf("%-12s %14s %14s %9s\n", "benchmark", "baseline ns", "current ns", "change");
+
+  for (size_t b = 0; b < BENCH_COUNT; b++) {
+    double before = baseline_median(baseline, BENCHMARKS[b].name);
+
+    qsort(runMedians[b], runs, sizeof(double), compare_doubles);
+    double now = runMedians[b][runs / 2];
+
+    if (before <= 0) {
+      printf("%-12s %14s %14.2f %9s\n", BENCHMARKS[b].name, "-", now, "new");
+      continue;
+    }
+
+    double change = (now - before) / before * 100;
+    int regressed = change > threshold;
+    regressions += regressed;
+
+    printf("%-12s %14.2f %14.2f %+8.1f%%%s\n", BENCHMARKS[b].name, before, now, change,
+           regressed ? "  REGRESSION" : "");
+  }
+
+  if (regressions) {
+    printf("\n%d benchmarks are more than %.1f%% slower than the baseline\n", regressions, threshold);
+  } else {
+    printf("\nNo benchmark is more than %.1f%% slower than the baseline\n", threshold);
+  }
+
+  bench_corpus_free(&corpus);
+  free(baseline);
+  return regressions != 0;
+}
+
+// Corpus generator defaults: game lengths are drawn uniformly from min-max plies, a game
+// that is mated or stalemated earlier stays shorter
+#define GENERATE_SEED 0x5eed5eedULL
+#define GENERATE_MIN_PLIES 20
+#define GENERATE_MAX_PLIES 120
+// more than the legal moves of any position
+#define GENERATE_MAX_MOVES 256
+#define GENERATE_BLOCK_PLIES 65536
+
+typedef enum {
+  GENERATE_NORMAL,
+  GENERATE_PROMOTIONS,
+  GENERATE_CAPTURES,
+  GENERATE_MODES,
+} GenerateMode;
+
+const char *GENERATE_MODE_NAMES[GENERATE_MODES] = {"normal", "promotions", "captures"};
+
+// How much more often the mode plays a move than a quiet one: captures mode takes 8 to 1,
+// promotions mode pushes pawns 4 to 1 and promotes 32 to 1
+int generate_weight(GameState *state, Move *move, GenerateMode mode) {
+  Piece piece = state->board[move->fromRank][move->fromFile];
+
+  if (mode == GENERATE_CAPTURES) {
+    return state->board[move->toRank][move->toFile].type != EMPTY ? 8 : 1;
+  }
+  if (piece.type != PAWN) {
+    return 1;
+  }
+  return move->toRank == 0 || move->toRank == 7 ? 32 : 4;
+}
+
+// Like random_legal_move, with the moves weighted for the mode; promotions mode also
+// underpromotes
+int generate_move(GameState *state, uint64_t *seed, GenerateMode mode, Move *move) {
+  static const int PROMOTIONS[] = {QUEEN, ROOK, BISHOP, KNIGHT};
+  Move moves[GENERATE_MAX_MOVES];
+  int weights[GENERATE_MAX_MOVES];
+  LegalSet legal;
+  int count = 0, total = 0;
+
+  if (mode == GENERATE_NORMAL) {
+    return random_legal_move(state, seed, move);
+  }
+
+  generate_legal_set(state, &legal);
+  uint64_t from = legal.fromMask;
+
+  for (int entry = 0; from; entry++) {
+    int square = __builtin_ctzll(from);
+    from &= from - 1;
+
+    for (uint64_t targets = legal.targets[entry]; targets && count < GENERATE_MAX_MOVES; targets &= targets - 1) {
+      int to = __builtin_ctzll(targets);
+      Move *next = &moves[count];
+      next->fromRank = square / 8;
+      next->fromFile = square % 8;
+      next->toRank = to / 8;
+      next->toFile = to % 8;
+      next->promotion = EMPTY;
+      if (state->board[square / 8][square % 8].type == PAWN && (to / 8 == 0 || to / 8 == 7)) {
+        next->promotion = mode == GENERATE_PROMOTIONS ? PROMOTIONS[random_next(seed) % 4] : QUEEN;
+      }
+      total += weights[count++] = generate_weight(state, next, mode);
+    }
+  }
+
+  if (!count) {
+    return 0;
+  }
+
+  int pick = random_next(seed) % total, i = 0;
+  while (pick >= weights[i]) {
+    pick -= weights[i++];
+  }
+  *move = moves[i];
+  return 1;
+}
+
+long generate_game(uint64_t *seed, GenerateMode mode, Move *out, long maxPlies) {
+  GameState state;
+  long plies = 0;
+
+  initializeBoard(&state);
+  while (plies < maxPlies && generate_move(&state, seed, mode, &out[plies])) {
+    playMove(&state, &out[plies++]);
+  }
+
+  return plies;
+}
+
+// Picks one of the moves of the side to move that its pieces could make but that leave
+// the own king in check; returns 0 if there is none
+int random_check_move(GameState *state, uint64_t *seed, Move *move) {
+  Color color = state->whiteToMove ? WHITE : BLACK;
+  Move candidate;
+  int count = 0;
+
+  for (int from = 0; from < 64; from++) {
+    Piece piece = state->board[from / 8][from % 8];
+    if (piece.type == EMPTY || piece.color != color) {
+      continue;
+    }
+
+    uint64_t targets = candidate_targets(piece.type, from / 8, from % 8);
+    while (targets) {
+      int to = __builtin_ctzll(targets);
+      targets &= targets - 1;
+
+      candidate.fromRank = from / 8;
+      candidate.fromFile = from % 8;
+      candidate.toRank = to / 8;
+      candidate.toFile = to % 8;
+      candidate.promotion = piece.type == PAWN && (candidate.toRank == 0 || candidate.toRank == 7) ? QUEEN : EMPTY;
+
+      // one pass, every such move is kept with the same chance
+      if (checkMove(state, &candidate) == MOVE_CHECK && random_next(seed) % ++count == 0) {
+        *move = candidate;
+      }
+    }
+  }
+
+  return count > 0;
+}
+
+// Swaps one ply of a legal game for a move the position doesn't allow, so every move
+// before it still replays. Half of them are moves into check where the position has
+// one, the subtle kind; the rest are random squares, mostly no piece or the wrong color.
+// Returns the index of the bad ply.
+long corrupt_game(uint64_t *seed, Move *moves, long plies) {
+  GameState state;
+  Move bad;
+  long k = random_next(seed) % plies;
+
+  initializeBoard(&state);
+  for (long i = 0; i < k; i++) {
+    playMove(&state, &moves[i]);
+  }
+
+  if (random_next(seed) % 2 && random_check_move(&state, seed, &bad)) {
+    moves[k] = bad;
+    return k;
+  }
+
+  do {
+    int from = random_next(seed) % 64, to = random_next(seed) % 64;
+    bad.fromRank = from / 8;
+    bad.fromFile = from % 8;
+    bad.toRank = to / 8;
+    bad.toFile = to % 8;
+    bad.promotion = EMPTY;
+  } while ((bad.fromRank == bad.toRank && bad.fromFile == bad.toFile) || checkMove(&state, &bad) == MOVE_OK);
+
+  moves[k] = bad;
+  return k;
+}
+
+int write_text_game(OutputBuffer *out, Move *moves, long plies) {
+  char *p = output_reserve(out, plies * 6 + 1);
+
+  if (!p) {
+    return 0;
+  }
+
+  for (long i = 0; i < plies; i++) {
+    unparse_move(&moves[i], p);
+    p += strlen(p);
+    *p++ = '\n';
+  }
+  // a blank line ends the game, as the pipeline reads them
+  *p++ = '\n';
+  out->used = p - out->data;
+  return 1;
+}
+
+// Every game has its own seed (splitmix64 of the corpus seed and the game number), so the
+// corpus doesn't depend on how the games are spread over threads
+uint64_t game_seed(uint64_t seed, uint64_t game) {
+  uint64_t z = seed + (game + 1) * 0x9e3779b97f4a7c15ULL;
+  z = (z ^ z >> 30) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ z >> 27) * 0x94d049bb133111ebULL;
+  z ^= z >> 31;
+  // xorshift gets stuck on zero
+  return z ? z : GENERATE_SEED;
+}
+
+typedef struct {
+  uint64_t seed;
+  GenerateMode mode;
+  long minPlies, maxPlies;
+  double corruptPercent;
+  uint64_t first, count; // games of the block
+  Move *moves; // maxPlies per game
+  long *plies;
+  long *badPly; // -1 for a legal game
+  int threaded; // run on its own thread this round, so it has to be joined
+} GenerateBlock;
+
+void *generate_block(void *arg) {
+  GenerateBlock *block = arg;
+
+  for (uint64_t i = 0; i < block->count; i++) {
+    uint64_t seed = game_seed(block->seed, block->first + i);
+    Move *moves = block->moves + i * block->maxPlies;
+    long length = block->minPlies + random_next(&seed) % (block->maxPlies - block->minPlies + 1);
+    long played = generate_game(&seed, block->mode, moves, length);
+
+    block->plies[i] = played;
+    block->badPly[i] = -1;
+    // the draw is taken out of 2^53 so the percentage can have decimals
+    if (played && (random_next(&seed) >> 11) * 0x1p-53 * 100 < block->corruptPercent) {
+      block->badPly[i] = corrupt_game(&seed, moves, played);
+    }
+  }
+
+  return NULL;
+}
+
+// lw10 generate <out.txt|archive> <games> [seed] [normal|promotions|captures] [min-max] [corrupt %] [threads]:
+// writes random legal games as text (games separated by blank lines) or into a new archive.
+// The given percentage of games gets one illegal ply, listed as "game ply" in <out>.bad.
+int command_generate(int argc, char **argv) {
+  GenerateBlock base;
+  OutputBuffer out;
+  Archive *ar = NULL;
+  FILE *fp = NULL, *bad = NULL;
+  char badFile[256], tempFile[256];
+  uint64_t games, seed = GENERATE_SEED, minPlies = GENERATE_MIN_PLIES, maxPlies = GENERATE_MAX_PLIES;
+  uint64_t threads = sysconf(_SC_NPROCESSORS_ONLN);
+  uint64_t plies = 0, corrupted = 0;
+  double corruptPercent = 0;
+  char *end = "";
+  int ok = 1;
+
+  memset(&base, 0, sizeof(base));
+  if (argc > 5) {
+    for (base.mode = 0; base.mode < GENERATE_MODES && strcmp(argv[5], GENERATE_MODE_NAMES[base.mode]); base.mode++) {
+    }
+  }
+  // the range is min-max or a single length
+  if (argc > 6) {
+    const char *dash = strchr(argv[6], '-');
+    char first[32];
+    if (!dash) {
+      ok = parse_unsigned(argv[6], 10, &minPlies);
+      maxPlies = minPlies;
+    } else if ((size_t) (dash - argv[6]) < sizeof(first)) {
+      memcpy(first, argv[6], dash - argv[6]);
+      first[dash - argv[6]] = '\0';
+      ok = parse_unsigned(first, 10, &minPlies) && parse_unsigned(dash + 1, 10, &maxPlies);
+    } else {
+      ok = 0;
+    }
+  }
+  if (argc > 7) {
+    corruptPercent = strtod(argv[7], &end);
+  }
+
+  if (argc < 4 || !ok || !parse_unsigned(argv[3], 10, &games) || (argc > 4 && !parse_unsigned(argv[4], 0, &seed)) ||
+      base.mode == GENERATE_MODES || minPlies < 1 || maxPlies < minPlies || maxPlies > INT32_MAX ||
+      (argc > 7 && (end == argv[7] || *end)) || !(corruptPercent >= 0 && corruptPercent <= 100) ||
+      (argc > 8 && (!parse_unsigned(argv[8], 10, &threads) || threads > INT_MAX))) {
+    fprintf(stderr, "usage: %s generate <out.txt|archive> <games> [seed] [normal|promotions|captures] [min-max] "
+            "[corrupt %%] [threads]\n", argv[0]);
+    return 2;
+  }
+  if (threads < 1) {
+    threads = 1;
+  }
+
+  base.seed = seed;
+  base.minPlies = minPlies;
+  base.maxPlies = maxPlies;
+  base.corruptPercent = corruptPercent;
+
+  // each thread fills a block of about GENERATE_BLOCK_PLIES moves per round, then the
+  // blocks are written in game order
+  uint64_t blockGames = base.maxPlies < GENERATE_BLOCK_PLIES ? GENERATE_BLOCK_PLIES / base.maxPlies : 1;
+  GenerateBlock *blocks = calloc(threads, sizeof(GenerateBlock));
+  pthread_t *ids = malloc(threads * sizeof(pthread_t));
+  PackedMove *packed = malloc(base.maxPlies * sizeof(PackedMove) + 1);
+
+  ok = blocks && ids && packed;
+  for (uint64_t t = 0; ok && t < threads; t++) {
+    blocks[t] = base;
+    blocks[t].moves = malloc(blockGames * base.maxPlies * sizeof(Move));
+    blocks[t].plies = malloc(blockGames * sizeof(long));
+    blocks[t].badPly = malloc(blockGames * sizeof(long));
+    ok = blocks[t].moves && blocks[t].plies && blocks[t].badPly;
+  }
+
+  // the corpus is written from scratch into a temporary file (an existing archive would be
+  // appended to) and replaces the output only once it is complete
+  snprintf(tempFile, sizeof(tempFile), "%s.tmp", argv[2]);
+  if (ok) {
+    remove(tempFile);
+  }
+  if (ok && has_extension(argv[2], ".txt")) {
+    fp = fopen(tempFile, "wb");
+    ok = fp && output_init(&out, fp);
+  } else if (ok) {
+    ok = (ar = archive_open(tempFile, 1)) != NULL;
+  }
+  if (ok && base.corruptPercent > 0) {
+    snprintf(badFile, sizeof(badFile), "%s.bad", argv[2]);
+    ok = (bad = fopen(badFile, "w")) != NULL;
+  }
+
+  double start = now_seconds();
+
+  for (uint64_t next = 0; ok && next < games;) {
+    int started = 0;
+
+    for (; started < (int) threads && next < games; started++) {
+      blocks[started].first = next;
+      blocks[started].count = games - next < blockGames ? games - next : blockGames;
+      next += blocks[started].count;
+      // without a thread the block is generated right here, the corpus is the same
+      blocks[started].threaded = pthread_create(&ids[started], NULL, generate_block, &blocks[started]) == 0;
+      if (!blocks[started].threaded) {
+        generate_block(&blocks[started]);
+      }
+    }
+    for (int t = 0; t < started; t++) {
+      if (blocks[t].threaded) {
+        pthread_join(ids[t], NULL);
+      }
+    }
+
+    for (int t = 0; t < started; t++) {
+      GenerateBlock *block = &blocks[t];
+
+      for (uint64_t i = 0; ok && i < block->count; i++) {
+        Move *moves = block->moves + i * block->maxPlies;
+        long played = block->plies[i];
+
+        if (block->badPly[i] >= 0) {
+          ok = fprintf(bad, "%llu %ld\n", (unsigned long long) (block->first + i + 1), block->badPly[i] + 1) > 0;
+          corrupted++;
+        }
+        if (ar) {
+          for (long k = 0; k < played; k++) {
+            packed[k] = pack_move(&moves[k]);
+          }
+          ok = ok && archive_append_packed(ar, packed, played, block->badPly[i] < 0);
+        } else {
+          ok = ok && write_text_game(&out, moves, played);
+        }
+        plies += played;
+      }
+    }
+  }
+
+  if (fp) {
+    ok = output_free(&out) && ok;
+    ok = fclose(fp) == 0 && ok;
+  }
+  if (ar) {
+    ok = archive_close(ar) && ok;
+  }
+  if (bad) {
+    ok = fclose(bad) == 0 && ok;
+  }
+  for (uint64_t t = 0; blocks && t < threads; t++) {
+    free(blocks[t].moves);
+    free(blocks[t].plies);
+    free(blocks[t].badPly);
+  }
+  free(blocks);
+  free(ids);
+  free(packed);
+
+  if (ok) {
+    ok = rename(tempFile, argv[2]) == 0;
+  } else {
+    remove(tempFile);
+  }
+  if (!ok) {
+    fprintf(stderr, "Unable to write %s\n", argv[2]);
+    return 1;
+  }
+
+  double elapsed = now_seconds() - start;
+  printf("%llu %s games, %llu plies, %llu corrupted on %d threads in %.3f s (%.0f games/s)\n",
+         (unsigned long long) games, GENERATE_MODE_NAMES[base.mode], (unsigned long long) plies,
+         (unsigned long long) corrupted, (int) threads, elapsed, elapsed > 0 ? games / elapsed : 0);
+  return 0;
+}
+
+// Writes the trace ring as Chrome trace event JSON (chrome://tracing, Perfetto), oldest first
+void trace_export(void) {
+  size_t count = atomic_load(&trace->next), first = 0;
+  FILE *fp = fopen(trace->filename, "w");
+  OutputBuffer out;
+
+  if (!fp || !output_init(&out, fp)) {
+    fprintf(stderr, "Unable to write the trace to %s\n", trace->filename);
+    if (fp) {
+      fclose(fp);
+    }
+    return;
+  }
+
+  if (count > trace->capacity) {
+    first = count - trace->capacity;
+  }
+
+  fputs("{\"traceEvents\": [\n", fp);
+  // the separator goes before each event, so stopping early still leaves valid JSON
+  size_t i = first;
+  for (; i < count; i++) {
+    TraceEvent *event = &trace->events[i % trace->capacity];
+    char *p = output_reserve(&out, 160);
+
+    if (!p) {
+      break;
+    }
+    out.used += sprintf(p, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, "
+                           "\"args\": {\"ply\": %d}}",
+                        i > first ? ",\n" : "", event->name, event->tid, event->start / 1000.0,
+                        (event->end - event->start) / 1000.0, event->ply);
+  }
+
+  int ok = output_free(&out) && i == count;
+  fputs("\n]}\n", fp);
+  ok = fclose(fp) == 0 && ok;
+
+  if (ok) {
+    fprintf(stderr, "Trace of %zu spans written to %s%s\n", count - first, trace->filename,
+            first ? " (the oldest were overwritten)" : "");
+  } else {
+    fprintf(stderr, "Unable to write the trace to %s\n", trace->filename);
+  }
+}
+
+void trace_init(void) {
+  const char *filename = getenv("LW10_TRACE");
+
+  if (!filename || !*filename) {
+    return;
+  }
+
+  trace = malloc(sizeof(TraceRing));
+  if (trace) {
+    trace->capacity = TRACE_EVENTS;
+    trace->events = malloc(trace->capacity * sizeof(TraceEvent));
+    trace->filename = filename;
+    atomic_init(&trace->next, 0);
+  }
+
+  if (!trace || !trace->events) {
+    fprintf(stderr, "Not enough memory for the trace, LW10_TRACE is ignored\n");
+    free(trace);
+    trace = NULL;
+    return;
+  }
+
+  atexit(trace_export);
+}
+
+int run_command(int argc, char **argv) {
+  interactive = 0;
+
+  if (strcmp(argv[1], "replay") == 0) {
+    return command_replay(argc, argv);
+  }
+  if (strcmp(argv[1], "check") == 0) {
+    return command_check(argc, argv);
+  }
+  if (strcmp(argv[1], "bench-load") == 0) {
+    return command_bench_load(argc, argv);
+  }
+  if (strcmp(argv[1], "ingest") == 0) {
+    return command_ingest(argc, argv);
+  }
+  if (strcmp(argv[1], "pipeline") == 0) {
+    return command_pipeline(argc, argv);
+  }
+  if (strcmp(argv[1], "ingest-dir") == 0) {
+    return command_ingest_dir(argc, argv);
+  }
+  if (strcmp(argv[1], "positions") == 0) {
+    return command_positions(argc, argv);
+  }
+  if (strcmp(argv[1], "board") == 0) {
+    return command_board(argc, argv);
+  }
+  if (strcmp(argv[1], "pgn") == 0) {
+    return command_pgn(argc, argv);
+  }
+  if (strcmp(argv[1], "export") == 0) {
+    return command_export(argc, argv);
+  }
+  if (strcmp(argv[1], "dump") == 0) {
+    return command_dump(argc, argv);
+  }
+  if (strcmp(argv[1], "image") == 0) {
+    return command_image(argc, argv);
+  }
+  if (strcmp(argv[1], "bench") == 0) {
+    return command_bench(argc, argv);
+  }
+  if (strcmp(argv[1], "bench-compare") == 0) {
+    return command_bench_compare(argc, argv);
+  }
+  if (strcmp(argv[1], "generate") == 0) {
+    return command_generate(argc, argv);
+  }
+
+  fprintf(stderr, "usage: %s [replay|check|bench-load|ingest|pipeline|ingest-dir|positions|board|pgn|export|dump|image|bench|bench-compare|generate] ...\n", argv[0]);
+  return 2;
+}
+
+int main(int argc, char **argv) {
+  trace_init();
+
+  if (argc > 1) {
+    return run_command(argc, argv);
+  }
+
+  Move *moves = NULL;
+  int option = 0, replaySize = 0;
+  int gameLength = 0;
+
+  // no en passant, no castling, format is: e2e4 (square from, square to)
+  while (1) {
+    invalidate_frame();
+    printf("Select an option:\n");
+    printf("  1. Insert a game\n");
+    printf("  2. Replay a game\n");
+    printf("  3. Edit the record\n");
+    printf("  4. Load game from a file\n");
+    printf("  5. Save game to a file\n");
+    printf("  6. Clear game record\n");
+    printf("  7. Exit\n");
+    printf("  8. Memory report\n\n> ");
+
+    while (scanf("%d", &option) != 1) {
+      printf("Wrong input! Try again...\n> ");
+      fflush(stdin);
+    }
+
+    // options 1 to 6 are numbered like their Operation
+    if (option >= OP_INSERT && option <= OP_CLEAR) {
+      begin_operation(option);
+    }
+
+    switch (option) {
+      case 1:
+        insertGame(&moves, &gameLength);
+        break;
+      case 2:
+        printf("Enter the number of move you want to see:\n\n> ");
+        while (scanf("%d", &replaySize) != 1) {
+          printf("Wrong input! Try again...\n> ");
+        }
+        if (replaySize <= 0 || replaySize > gameLength) {
+          printf("The move number is out of range!\n");
+          break;
+        }
+        replayGame(moves, gameLength, replaySize);
+        break;
+      case 3:
+        edit_prompt(&moves, &gameLength);
+        break;
+      case 4:
+        load_data(&moves, &gameLength);
+        break;
+      case 5:
+        save_data(moves, &gameLength);
+        break;
+      case 6:
+        gameLength = 0;
+        reset_session(&moves);
+        break;
+      case 7:
+        printf("\nSee you next time\n\n");
+        return 0;
+        break;
+      case 8:
+        memory_report();
+        break;
+      default:
+        printf("There's no such option. Try again...\n> ");
+        break;
+    }
+    end_operation();
+    fflush(stdin);
+  }
+  
+  return 0;
 }
\ No newline at end of file